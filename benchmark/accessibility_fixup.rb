@@ -0,0 +1,35 @@
+# frozen_string_literal: true
+
+# Compares mark_paths_as_artifacts + ensure_bbox with the single pass of
+# Document#accessibility_fixup on large synthetic tagged pages:
+#
+#   bundle exec rake benchmark
+#   PAGES=50 RECTS=100000 THREADS=8 bundle exec ruby -Ilib benchmark/accessibility_fixup.rb
+
+require "benchmark"
+require "etc"
+require "qpdf_ruby"
+require_relative "support/synthetic_pdf"
+
+pages = Integer(ENV.fetch("PAGES", 20))
+rects = Integer(ENV.fetch("RECTS", 100_000))
+threads = Integer(ENV.fetch("THREADS", Etc.nprocessors))
+pdf = SyntheticPdf.build(pages: pages, rects_per_page: rects, tagged: true)
+
+puts "accessibility_fixup: #{pages} pages x #{rects} rects (#{pdf.bytesize / 1024} KiB)"
+
+timings = nil
+Benchmark.bm(16) do |x|
+  [1, threads].uniq.each do |count|
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+    x.report("#{count}t separate") do
+      doc.mark_paths_as_artifacts(threads: count)
+      doc.ensure_bbox(threads: count)
+    end
+
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+    x.report("#{count}t one pass") { timings = doc.accessibility_fixup(threads: count) }
+  end
+end
+
+puts "phases of the last run: #{timings.map { |phase, seconds| format("%s %.3fs", phase, seconds) }.join(", ")}"
@@ -0,0 +1,28 @@
+# frozen_string_literal: true
+
+# Times Document#mark_paths_as_artifacts on large synthetic pages.
+# Run on two checkouts (e.g. before/after a change) and compare:
+#
+#   bundle exec rake benchmark
+#   PAGES=50 RECTS=100000 THREADS=8 bundle exec ruby -Ilib benchmark/mark_paths_as_artifacts.rb
+
+require "benchmark"
+require "etc"
+require "qpdf_ruby"
+require_relative "support/synthetic_pdf"
+
+pages = Integer(ENV.fetch("PAGES", 20))
+rects = Integer(ENV.fetch("RECTS", 100_000))
+threads = Integer(ENV.fetch("THREADS", Etc.nprocessors))
+pdf = SyntheticPdf.build(pages: pages, rects_per_page: rects)
+
+puts "mark_paths_as_artifacts: #{pages} pages x #{rects} rects (#{pdf.bytesize / 1024} KiB)"
+
+Benchmark.bm(12) do |x|
+  [1, threads].uniq.each do |count|
+    3.times do |run|
+      doc = QpdfRuby::Document.from_memory(pdf, "")
+      x.report("#{count}t run #{run + 1}") { doc.mark_paths_as_artifacts(threads: count) }
+    end
+  end
+end
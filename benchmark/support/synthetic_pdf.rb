@@ -0,0 +1,56 @@
+# frozen_string_literal: true
+
+# Builds uncompressed, Chromium-like PDFs in memory for the benchmarks:
+# many pages, each with lots of `re f` background boxes between text runs.
+# `tagged: true` wraps each page in a Figure (without a BBox) of a minimal
+# structure tree, for the benchmarks that need one.
+module SyntheticPdf
+  module_function
+
+  def build(pages:, rects_per_page:, tagged: false)
+    objects = ["<< /Type /Catalog /Pages 2 0 R >>", nil]
+    kids = []
+
+    pages.times do
+      content = page_content(rects_per_page)
+      content = "/Figure << /MCID 0 >> BDC\n#{content}EMC\n" if tagged
+      objects << "<< /Length #{content.bytesize} >>\nstream\n#{content}\nendstream"
+      kids << "#{objects.size + 1} 0 R"
+      objects << "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 595 842] /Contents #{objects.size} 0 R " \
+                 "/Resources << /Font << /F1 << /Type /Font /Subtype /Type1 /BaseFont /Helvetica >> >> >> >>"
+    end
+    objects[1] = "<< /Type /Pages /Kids [#{kids.join(" ")}] /Count #{pages} >>"
+    add_structure_tree(objects, kids) if tagged
+
+    serialize(objects)
+  end
+
+  def add_structure_tree(objects, pages)
+    root = objects.size + 1
+    figures = pages.each_index.map { |i| "#{root + 1 + i} 0 R" }
+    objects << "<< /Type /StructTreeRoot /K [#{figures.join(" ")}] >>"
+    pages.each { |page| objects << "<< /Type /StructElem /S /Figure /P #{root} 0 R /Pg #{page} /K 0 >>" }
+    objects[0] = "<< /Type /Catalog /Pages 2 0 R /MarkInfo << /Marked true >> /StructTreeRoot #{root} 0 R >>"
+  end
+
+  def page_content(rects)
+    Array.new(rects) do |i|
+      box = "#{i % 580} #{(i * 7) % 820} 12.5 3.25 re\nf\n"
+      (i % 10).zero? ? "#{box}BT /F1 8 Tf #{i % 580} #{(i * 7) % 820} Td (cell #{i}) Tj ET\n" : box
+    end.join
+  end
+
+  def serialize(objects)
+    pdf = +"%PDF-1.7\n"
+    offsets = objects.each_with_index.map do |body, index|
+      offset = pdf.bytesize
+      pdf << "#{index + 1} 0 obj\n#{body}\nendobj\n"
+      offset
+    end
+
+    xref = pdf.bytesize
+    pdf << "xref\n0 #{objects.size + 1}\n0000000000 65535 f \n"
+    offsets.each { |offset| pdf << format("%010d 00000 n \n", offset) }
+    pdf << "trailer\n<< /Size #{objects.size + 1} /Root 1 0 R >>\nstartxref\n#{xref}\n%%EOF\n"
+  end
+end
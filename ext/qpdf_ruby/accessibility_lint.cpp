@@ -0,0 +1,159 @@
+#include "accessibility_lint.hpp"
+#include "pdf_struct_walker.hpp"
+#include "without_gvl.hpp"
+
+#include <algorithm>
+#include <set>
+#include <string_view>
+#include <unordered_map>
+
+using namespace qpdf_ruby;
+using Issue = AccessibilityLint::Issue;
+using Kind = StructureModel::Kind;
+using Node = StructureModel::Node;
+
+namespace {
+
+constexpr uint32_t NO_ELEMENT = UINT32_MAX;
+
+// An MCID the structure tree points at, and the element whose /K does so
+struct Reference {
+  int mcid;
+  uint32_t element;
+};
+
+bool has_text_attribute(StructureModel const& model, Node const& node, std::string_view name) {
+  for (uint32_t i = node.first_attribute; i < node.first_attribute + node.attribute_count; ++i) {
+    auto const& attribute = model.attribute(i);
+    if (model.text(attribute.name) == name && !model.text(attribute.value).empty()) return true;
+  }
+  return false;
+}
+
+void check_catalog(QPDFObjectHandle root, std::vector<Issue>& issues) {
+  int obj = root.getObjectID();
+  int gen = root.getGeneration();
+
+  QPDFObjectHandle mark_info = root.getKey("/MarkInfo");
+  QPDFObjectHandle marked = mark_info.isDictionary() ? mark_info.getKey("/Marked") : QPDFObjectHandle::newNull();
+  if (!marked.isBool() || !marked.getBoolValue()) {
+    issues.push_back({"not_marked", "/MarkInfo /Marked is not true", obj, gen});
+  }
+
+  QPDFObjectHandle lang = root.getKey("/Lang");
+  if (!lang.isString() || lang.getUTF8Value().empty()) {
+    issues.push_back({"no_language", "the catalog has no /Lang", obj, gen});
+  }
+}
+
+}  // namespace
+
+std::vector<Issue> AccessibilityLint::check(DocumentHandle& doc, unsigned threads) {
+  std::vector<Issue> issues;
+  QPDF& pdf = doc.qpdf();
+  QPDFObjectHandle root = pdf.getRoot();
+
+  check_catalog(root, issues);
+  if (!root.getKey("/StructTreeRoot").isDictionary()) {
+    issues.push_back({"no_structure_tree", "the catalog has no /StructTreeRoot", root.getObjectID(),
+                      root.getGeneration()});
+    return issues;
+  }
+
+  StructureModel const& structure = doc.structure();
+  std::vector<QPDFObjectHandle> const& pages = pdf.getAllPages();
+  std::unordered_map<QPDFObjGen, int, ObjGenHash> page_numbers;
+  for (size_t i = 0; i < pages.size(); ++i) page_numbers.emplace(pages[i].getObjGen(), static_cast<int>(i) + 1);
+
+  // Structure pass: element checks, and which MCIDs each page should hold
+  std::vector<std::vector<Reference>> referenced(pages.size());
+  std::vector<std::pair<uint32_t, uint32_t>> stack;  // (node, enclosing element)
+  for (uint32_t i = structure.rootCount(); i-- > 0;) stack.emplace_back(i, NO_ELEMENT);
+
+  while (!stack.empty()) {
+    auto [index, parent] = stack.back();
+    stack.pop_back();
+    Node const& node = structure.node(index);
+
+    if (node.kind == Kind::Element) {
+      if (structure.text(node.name) == "Figure" && !has_text_attribute(structure, node, "Alt") &&
+          !has_text_attribute(structure, node, "ActualText")) {
+        issues.push_back({"figure_without_alt", "Figure has neither /Alt nor /ActualText", node.obj, node.gen,
+                          node.page});
+      }
+      for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) stack.emplace_back(i, index);
+      continue;
+    }
+    if ((node.kind != Kind::Mcid && node.kind != Kind::Mcr) || parent == NO_ELEMENT) continue;
+
+    Node const& element = structure.node(parent);
+    int page = node.kind == Kind::Mcr ? node.page : element.page;
+    if (page < 1 || static_cast<size_t>(page) > pages.size()) {
+      issues.push_back({"mcid_without_page",
+                        "MCID " + std::to_string(node.mcid) + " belongs to no page: neither it nor an ancestor has /Pg",
+                        element.obj, element.gen, -1, node.mcid});
+      continue;
+    }
+    referenced[page - 1].push_back({node.mcid, parent});
+  }
+
+  for (auto const& figure : structure.figures()) {
+    if (figure.has_layout_bbox) continue;
+    auto page = figure.page.isIndirect() ? page_numbers.find(figure.page.getObjGen()) : page_numbers.end();
+    issues.push_back({"figure_without_bbox", "Figure has no layout /BBox", figure.element.getObjectID(),
+                      figure.element.getGeneration(), page == page_numbers.end() ? -1 : page->second});
+  }
+
+  // Content pass: cross-check the MCIDs each page opens against those the tree refers to
+  std::set<QPDFObjGen> all_pages;
+  for (auto const& page : pages) all_pages.insert(page.getObjGen());
+  McidIndex& index = doc.mcid_index();
+  index.indexPages(pdf, all_pages, threads);
+  ParentTreeIndex const& parents = doc.parent_tree();
+
+  for (size_t i = 0; i < pages.size(); ++i) {
+    check_interrupts();
+    QPDFObjGen page = pages[i].getObjGen();
+    int number = static_cast<int>(i) + 1;
+    std::string on_page = " on page " + std::to_string(number);
+
+    auto& refs = referenced[i];
+    std::stable_sort(refs.begin(), refs.end(), [](Reference const& a, Reference const& b) { return a.mcid < b.mcid; });
+
+    std::vector<int> const& in_content = index.mcids(page);
+    for (int content_mcid : in_content) {
+      auto ref = std::lower_bound(refs.begin(), refs.end(), content_mcid,
+                                  [](Reference const& r, int mcid) { return r.mcid < mcid; });
+      std::string mcid = "MCID " + std::to_string(content_mcid);
+      if (ref == refs.end() || ref->mcid != content_mcid) {
+        issues.push_back({"mcid_without_element", mcid + on_page + " is not part of the structure tree", 0, 0, number,
+                          content_mcid});
+      } else if (parents.find(page, content_mcid).isNull()) {
+        Node const& element = structure.node(ref->element);
+        issues.push_back({"mcid_not_in_parent_tree", mcid + on_page + " has no /ParentTree entry", element.obj,
+                          element.gen, number, content_mcid});
+      }
+    }
+
+    for (size_t k = 0; k < refs.size(); ++k) {
+      Node const& element = structure.node(refs[k].element);
+      std::string mcid = "MCID " + std::to_string(refs[k].mcid);
+      if (k > 0 && refs[k - 1].mcid == refs[k].mcid) {
+        issues.push_back({"mcid_shared", mcid + on_page + " belongs to more than one structure element", element.obj,
+                          element.gen, number, refs[k].mcid});
+      } else if (!std::binary_search(in_content.begin(), in_content.end(), refs[k].mcid)) {
+        issues.push_back({"element_without_content", mcid + on_page + " is referenced but not in the page content",
+                          element.obj, element.gen, number, refs[k].mcid});
+      }
+    }
+
+    if (size_t untagged = index.untagged(page).size(); untagged > 0) {
+      issues.push_back({"untagged_content",
+                        std::to_string(untagged) + " graphics object(s)" + on_page +
+                            " are neither marked content nor artifacts",
+                        pages[i].getObjectID(), pages[i].getGeneration(), number});
+    }
+  }
+
+  return issues;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include "document_handle.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * PAC-style accessibility checks, run in-process: the catalog, one walk
+ * over the parsed structure tree and one scan of the page content, the
+ * latter shared with ensure_bbox through the document's McidIndex. The
+ * MCIDs the content opens are cross-checked with those the tree refers
+ * to, in both directions.
+ */
+class AccessibilityLint {
+ public:
+  struct Issue {
+    char const* rule;     // e.g. "figure_without_alt"
+    std::string message;  // for humans
+    int obj = 0;          // the offending object, 0 if none is known
+    int gen = 0;
+    int page = -1;  // 1-based, -1 if the issue isn't tied to a page
+    int mcid = -1;
+  };
+
+  /** Runs every check; `threads` > 1 scans the content of several pages at once. */
+  static std::vector<Issue> check(qpdf_ruby::DocumentHandle& doc, unsigned threads = 1);
+};
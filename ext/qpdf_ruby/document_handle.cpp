@@ -1,6 +1,7 @@
 #define POINTERHOLDER_TRANSITION 1
 
 #include "document_handle.hpp"
+#include "without_gvl.hpp"
 
 #include <qpdf/QPDFWriter.hh>
 #include <qpdf/QPDF.hh>
@@ -10,6 +11,16 @@
 
 using namespace qpdf_ruby;
 
+namespace {
+
+// QPDFWriter reports every percent of progress; use that as a cancellation point.
+class InterruptCheckingReporter : public QPDFWriter::ProgressReporter {
+ public:
+  void reportProgress(int) override { check_interrupts(); }
+};
+
+}  // namespace
+
 std::unique_ptr<DocumentHandle> DocumentHandle::open(const std::string& filename, std::string const& pwd) {
   auto qpdf = std::make_shared<QPDF>();
   try {
@@ -25,28 +36,59 @@ std::unique_ptr<DocumentHandle> DocumentHandle::open(const std::string& filename
 
 std::unique_ptr<DocumentHandle> DocumentHandle::open_memory(std::string const& desc, std::vector<unsigned char> buf,
                                                             std::string const& pwd) {
+  // moving a vector keeps its heap block, so QPDF's view of it stays valid
+  auto h = open_memory_borrowed(desc, reinterpret_cast<char const*>(buf.data()), buf.size(), pwd);
+  h->m_owned_buf = std::move(buf);  // keep bytes alive
+  return h;
+}
+
+std::unique_ptr<DocumentHandle> DocumentHandle::open_memory_borrowed(std::string const& desc, char const* data,
+                                                                     size_t size, std::string const& pwd) {
   auto qpdf = std::make_shared<QPDF>();
   try {
-    qpdf->processMemoryFile(desc.c_str(), reinterpret_cast<char const*>(buf.data()), buf.size(),
-                            pwd.empty() ? nullptr : pwd.c_str());
+    qpdf->processMemoryFile(desc.c_str(), data, size, pwd.empty() ? nullptr : pwd.c_str());
   } catch (std::exception const& ex) {
     throw std::runtime_error("qpdf_ruby: open_memory failed: " + std::string(ex.what()));
   }
 
-  auto h = std::unique_ptr<DocumentHandle>(new DocumentHandle(qpdf));
-  h->m_owned_buf = std::move(buf);  // keep bytes alive
-  return h;
+  return std::unique_ptr<DocumentHandle>(new DocumentHandle(qpdf));
 }
 
 DocumentHandle::DocumentHandle(std::shared_ptr<QPDF> qpdf) : m_qpdf(std::move(qpdf)) {}
 
+McidIndex& DocumentHandle::mcid_index() {
+  if (!m_mcid_index) m_mcid_index = std::make_unique<McidIndex>();
+  return *m_mcid_index;
+}
+
+const StructureModel& DocumentHandle::structure() { return *shared_structure(); }
+
+std::shared_ptr<const StructureModel> DocumentHandle::shared_structure() {
+  if (!m_structure) m_structure = std::make_shared<StructureModel>(StructureModel::build(*m_qpdf, m_structure_limits));
+  return m_structure;
+}
+
+const ParentTreeIndex& DocumentHandle::parent_tree() {
+  if (!m_parent_tree) {
+    m_parent_tree = std::make_unique<ParentTreeIndex>(ParentTreeIndex::build(*m_qpdf, m_structure_limits.max_nodes));
+  }
+  return *m_parent_tree;
+}
+
+void DocumentHandle::configure_writer(QPDFWriter& w) const {
+  w.setStaticID(true);  // deterministic IDs – helps tests
+  w.registerProgressReporter(std::make_shared<InterruptCheckingReporter>());
+  setup_encryption(w);
+}
+
 void DocumentHandle::write(const std::string& out_filename) {
   try {
     // honour original file’s extension-level features (linearized? encrypted? …)
     QPDFWriter w(*m_qpdf, out_filename.c_str());
-    w.setStaticID(true);  // deterministic IDs – helps tests
-    setup_encryption(w);
+    configure_writer(w);
     w.write();
+  } catch (const Interrupted&) {
+    throw;
   } catch (const std::exception& ex) {
     throw std::runtime_error(std::string("qpdf_ruby: failed to write “") + out_filename + "”: " + ex.what());
   }
@@ -55,20 +97,36 @@ void DocumentHandle::write(const std::string& out_filename) {
 std::string DocumentHandle::write_to_memory() {
   try {
     QPDFWriter w(*m_qpdf, nullptr);
-    w.setStaticID(true);
-
-    setup_encryption(w);
+    configure_writer(w);
 
     w.setOutputMemory();
     w.write();
 
     auto b = w.getBuffer();
     return std::string(reinterpret_cast<char const*>(b->getBuffer()), b->getSize());
+  } catch (Interrupted const&) {
+    throw;
   } catch (std::exception const& ex) {
     throw std::runtime_error("qpdf_ruby: write_to_memory failed: " + std::string(ex.what()));
   }
 }
 
+void DocumentHandle::write_to(Pipeline* out) {
+  try {
+    QPDFWriter w(*m_qpdf, nullptr);
+    configure_writer(w);
+
+    w.setOutputPipeline(out);
+    w.write();
+  } catch (Interrupted const&) {
+    throw;
+  } catch (RubyError const&) {
+    throw;
+  } catch (std::exception const& ex) {
+    throw std::runtime_error("qpdf_ruby: write_to failed: " + std::string(ex.what()));
+  }
+}
+
 void DocumentHandle::setup_encryption(QPDFWriter& w) const {
   if (!m_encryption_requested) return;
 
@@ -127,6 +185,10 @@ DocumentHandle* qpdf_ruby_open_memory(char const* desc, unsigned char const* buf
   return DocumentHandle::open_memory(desc, std::move(copy), pwd ? pwd : "").release();
 }
 
+DocumentHandle* qpdf_ruby_open_memory_borrowed(char const* desc, char const* buf, size_t len, char const* pwd) {
+  return DocumentHandle::open_memory_borrowed(desc, buf, len, pwd ? pwd : "").release();
+}
+
 int qpdf_ruby_write(DocumentHandle* handle, const char* out_filename) {
   if (!handle) {
     errno = EBADF;
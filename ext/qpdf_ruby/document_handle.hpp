@@ -7,6 +7,10 @@
 #include <qpdf/QPDF.hh>
 #include <qpdf/QPDFWriter.hh>
 
+#include "mcid_index.hpp"
+#include "parent_tree_index.hpp"
+#include "structure_model.hpp"
+
 namespace qpdf_ruby {
 
 /**
@@ -22,6 +26,9 @@ class DocumentHandle final {
   static std::unique_ptr<DocumentHandle> open(const std::string& filename, std::string const& pwd);
   static std::unique_ptr<DocumentHandle> open_memory(std::string const& description, std::vector<unsigned char> data,
                                                      std::string const& password = "");
+  /** Like open_memory, but without copying: `data` must stay alive and unchanged as long as the handle. */
+  static std::unique_ptr<DocumentHandle> open_memory_borrowed(std::string const& description, char const* data,
+                                                              size_t size, std::string const& password = "");
 
   // ---- public API -------------------------------------------------------
   /** Write the (possibly-modified) PDF to disk. */
@@ -29,6 +36,9 @@ class DocumentHandle final {
 
   std::string write_to_memory();
 
+  /** Stream the PDF into `out` (e.g. a pipeline feeding a Ruby IO) without buffering it. */
+  void write_to(Pipeline* out);
+
   void set_encryption(const std::string& user_pw, const std::string& owner_pw, int R, qpdf_r3_print_e allow_print,
                       bool allow_modify, bool allow_extract, bool accessibility = true, bool assemble = true,
                       bool annotate_and_form = true, bool form_filling = true, bool encrypt_metadata = true,
@@ -39,6 +49,42 @@ class DocumentHandle final {
   QPDF& qpdf() { return *m_qpdf; }
   const QPDF& qpdf() const { return *m_qpdf; }
 
+  /** (page, MCID) index of this document, filled page by page on demand. */
+  McidIndex& mcid_index();
+
+  /** Drops everything derived from page content; call after rewriting content streams. */
+  void content_changed() { m_mcid_index.reset(); }
+
+  /** The structure tree of this document, parsed on first use. Throws if there is none. */
+  const StructureModel& structure();
+
+  /** The same model, kept alive for callers that outlast a structure_changed() (e.g. a Ruby enumerator). */
+  std::shared_ptr<const StructureModel> shared_structure();
+
+  /** (page, MCID) → element map decoded from the ParentTree on first use. */
+  const ParentTreeIndex& parent_tree();
+
+  /** Drops the parsed structure tree and ParentTree; call after editing the structure. */
+  void structure_changed() {
+    m_structure.reset();
+    m_parent_tree.reset();
+  }
+
+  /** Budgets for parsing the structure tree; a tree parsed under other limits is dropped. */
+  void set_structure_limits(StructureModel::Limits const& limits) {
+    m_structure_limits = limits;
+    structure_changed();
+  }
+  const StructureModel::Limits& structure_limits() const { return m_structure_limits; }
+
+  /**
+   * Marks the handle as used by a native call running without the GVL.
+   * Returns false if another Ruby thread is already working on it.
+   * Only called while holding the GVL, which serialises the check.
+   */
+  bool try_acquire() { return m_busy ? false : (m_busy = true); }
+  void release() { m_busy = false; }
+
   // ---- rule of five -----------------------------------------------------
   ~DocumentHandle() = default;
   DocumentHandle(const DocumentHandle&) = delete;
@@ -48,9 +94,15 @@ class DocumentHandle final {
 
  private:
   explicit DocumentHandle(std::shared_ptr<QPDF> qpdf);
+  void configure_writer(QPDFWriter& w) const;
 
   std::shared_ptr<QPDF> m_qpdf;
   std::vector<unsigned char> m_owned_buf;
+  bool m_busy = false;
+  std::unique_ptr<McidIndex> m_mcid_index;
+  std::shared_ptr<const StructureModel> m_structure;
+  std::unique_ptr<ParentTreeIndex> m_parent_tree;
+  StructureModel::Limits m_structure_limits;
 
   // --- New encryption settings ---
   bool m_encryption_requested = false;
@@ -74,6 +126,9 @@ DocumentHandle* qpdf_ruby_open(const char* filename, char const* pwd);
 
 DocumentHandle* qpdf_ruby_open_memory(char const* desc, unsigned char const* buf, size_t len, char const* pwd);
 
+/** Zero-copy variant: `buf` is borrowed and must outlive the returned handle. */
+DocumentHandle* qpdf_ruby_open_memory_borrowed(char const* desc, char const* buf, size_t len, char const* pwd);
+
 /** Writes PDF; returns 0 on success, -1 on error (see errno). */
 int qpdf_ruby_write(DocumentHandle* handle, const char* out_filename);
 
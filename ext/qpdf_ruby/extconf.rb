@@ -15,6 +15,12 @@ else
   $LDFLAGS << " -lqpdf"
 end
 
+# Rewritten content streams are Flate compressed with zlib directly
+dir_config("z")
+unless have_header("zlib.h") && have_library("z", "compress2", "zlib.h")
+  abort "zlib was not found: install its development package (e.g. zlib1g-dev) or pass --with-z-dir"
+end
+
 if RbConfig::CONFIG["host_os"] =~ /darwin/
   $LDFLAGS << " -Wl,-search_paths_first -Wl,-headerpad_max_install_names -Wl,-multiply_defined,suppress"
   $LDFLAGS << " -Wl,-undefined,dynamic_lookup"
@@ -0,0 +1,143 @@
+#include "mcid_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr size_t NODE_CAPACITY = 8;
+
+static bool intersects(McidIndex::BBox const& a, McidIndex::BBox const& b) {
+  return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
+
+static McidIndex::BBox unite(McidIndex::BBox const& a, McidIndex::BBox const& b) {
+  return {std::min(a[0], b[0]), std::min(a[1], b[1]), std::max(a[2], b[2]), std::max(a[3], b[3])};
+}
+
+// Orders `items` into vertical slices by x, each slice sorted by y, so that
+// runs of NODE_CAPACITY consecutive items are spatially compact.
+template <typename T, typename BoxOf>
+static void str_order(std::vector<T>& items, BoxOf box_of) {
+  size_t leaves = (items.size() + NODE_CAPACITY - 1) / NODE_CAPACITY;
+  size_t slices = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(leaves))));
+  size_t slice_size = std::max<size_t>(1, slices) * NODE_CAPACITY;
+
+  auto center_x = [&](T const& t) { return box_of(t)[0] + box_of(t)[2]; };
+  auto center_y = [&](T const& t) { return box_of(t)[1] + box_of(t)[3]; };
+
+  std::sort(items.begin(), items.end(), [&](T const& a, T const& b) { return center_x(a) < center_x(b); });
+  for (size_t i = 0; i < items.size(); i += slice_size) {
+    auto end = items.begin() + std::min(items.size(), i + slice_size);
+    std::sort(items.begin() + i, end, [&](T const& a, T const& b) { return center_y(a) < center_y(b); });
+  }
+}
+
+template <typename T, typename BoxOf>
+static std::vector<McidIndex::Node> pack(std::vector<T> const& items, size_t base, bool leaf, BoxOf box_of) {
+  std::vector<McidIndex::Node> level;
+  for (size_t i = 0; i < items.size(); i += NODE_CAPACITY) {
+    size_t count = std::min(NODE_CAPACITY, items.size() - i);
+    McidIndex::BBox bbox = box_of(items[i]);
+    for (size_t j = 1; j < count; ++j) bbox = unite(bbox, box_of(items[i + j]));
+    level.push_back({bbox, static_cast<uint32_t>(base + i), static_cast<uint32_t>(count), leaf});
+  }
+  return level;
+}
+
+McidIndex::PageTree McidIndex::build(std::map<int, BBox> const& boxes) {
+  PageTree tree;
+  for (auto const& [mcid, bbox] : boxes) tree.entries.push_back({mcid, bbox});
+  if (tree.entries.empty()) return tree;
+
+  auto entry_box = [](Entry const& e) -> BBox const& { return e.bbox; };
+  auto node_box = [](Node const& n) -> BBox const& { return n.bbox; };
+
+  str_order(tree.entries, entry_box);
+  std::vector<Node> level = pack(tree.entries, 0, true, entry_box);
+  while (level.size() > 1) {
+    str_order(level, node_box);
+    size_t base = tree.nodes.size();
+    tree.nodes.insert(tree.nodes.end(), level.begin(), level.end());
+    level = pack(level, base, false, node_box);
+  }
+  tree.nodes.push_back(level.front());
+
+  tree.by_mcid.resize(tree.entries.size());
+  for (uint32_t i = 0; i < tree.by_mcid.size(); ++i) tree.by_mcid[i] = i;
+  std::sort(tree.by_mcid.begin(), tree.by_mcid.end(),
+            [&](uint32_t a, uint32_t b) { return tree.entries[a].mcid < tree.entries[b].mcid; });
+
+  return tree;
+}
+
+void McidIndex::indexPages(QPDF& pdf, std::set<QPDFObjGen> const& pages, unsigned threads,
+                           qpdf_ruby::PhaseTimings* timings) {
+  std::set<QPDFObjGen> missing;
+  for (auto const& page : pages) {
+    if (!isIndexed(page)) missing.insert(page);
+  }
+  if (missing.empty()) return;
+
+  PDFImageMapper mapper(0, threads, &m_forms);
+  mapper.find(pdf, missing, timings);
+
+  auto const& scanned = mapper.getPageMcidBBoxes();
+  auto const& tagging = mapper.getPageTagging();
+  for (auto const& page : missing) {
+    auto it = scanned.find(page);
+    m_pages[page] = it == scanned.end() ? PageTree() : build(it->second);  // not a page of `pdf`: stays empty
+    if (auto t = tagging.find(page); t != tagging.end()) m_pages[page].tagging = t->second;
+  }
+}
+
+void McidIndex::markPathsAndIndex(QPDF& pdf, PDFArtifactMarker const& marker, unsigned threads,
+                                  qpdf_ruby::PhaseTimings* timings) {
+  PDFImageMapper mapper(0, threads, &m_forms);
+  mapper.findAndMarkPaths(pdf, marker, timings);
+
+  m_pages.clear();
+  for (auto const& [page, boxes] : mapper.getPageMcidBBoxes()) m_pages[page] = build(boxes);
+  for (auto const& [page, tagging] : mapper.getPageTagging()) m_pages[page].tagging = tagging;
+}
+
+PDFImageMapper::PageTagging const& McidIndex::tagging(QPDFObjGen const& page) const {
+  static PDFImageMapper::PageTagging const none;
+  auto it = m_pages.find(page);
+  return it == m_pages.end() ? none : it->second.tagging;
+}
+
+std::optional<McidIndex::BBox> McidIndex::find(QPDFObjGen const& page, int mcid) const {
+  auto it = m_pages.find(page);
+  if (it == m_pages.end()) return std::nullopt;
+
+  PageTree const& tree = it->second;
+  auto pos = std::lower_bound(tree.by_mcid.begin(), tree.by_mcid.end(), mcid,
+                              [&](uint32_t i, int value) { return tree.entries[i].mcid < value; });
+  if (pos == tree.by_mcid.end() || tree.entries[*pos].mcid != mcid) return std::nullopt;
+  return tree.entries[*pos].bbox;
+}
+
+std::vector<McidIndex::Entry> McidIndex::query(QPDFObjGen const& page, BBox const& rect) const {
+  std::vector<Entry> result;
+
+  auto it = m_pages.find(page);
+  if (it == m_pages.end() || it->second.nodes.empty()) return result;
+
+  PageTree const& tree = it->second;
+  std::vector<uint32_t> pending = {static_cast<uint32_t>(tree.nodes.size() - 1)};
+  while (!pending.empty()) {
+    Node const& node = tree.nodes[pending.back()];
+    pending.pop_back();
+    if (!intersects(node.bbox, rect)) continue;
+
+    for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+      if (!node.leaf) {
+        pending.push_back(i);
+      } else if (intersects(tree.entries[i].bbox, rect)) {
+        result.push_back(tree.entries[i]);
+      }
+    }
+  }
+
+  std::sort(result.begin(), result.end(), [](Entry const& a, Entry const& b) { return a.mcid < b.mcid; });
+  return result;
+}
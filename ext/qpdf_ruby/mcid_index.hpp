@@ -0,0 +1,83 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjGen.hh>
+
+#include "pdf_artifact_marker.hpp"
+#include "pdf_image_mapper.hpp"
+#include "phase_timings.hpp"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+/**
+ * Per-document index of the area covered by each marked content sequence,
+ * keyed by (page, MCID). Pages are scanned on first use; each page's boxes
+ * are packed into a static R-tree (sort-tile-recursive) for region queries.
+ * The same scan records which MCIDs each page opens and what it paints
+ * untagged.
+ */
+class McidIndex {
+ public:
+  using BBox = std::array<double, 4>;  // [llx, lly, urx, ury]
+
+  struct Entry {
+    int mcid;
+    BBox bbox;
+  };
+
+  /** Scans those of `pages` that are not indexed yet. */
+  void indexPages(QPDF& pdf, std::set<QPDFObjGen> const& pages, unsigned threads = 1,
+                  qpdf_ruby::PhaseTimings* timings = nullptr);
+
+  /**
+   * Marks rectangle paths as artifacts with `marker` and (re)indexes every
+   * page from the same pass over the content (see PDFImageMapper::findAndMarkPaths).
+   */
+  void markPathsAndIndex(QPDF& pdf, PDFArtifactMarker const& marker, unsigned threads = 1,
+                         qpdf_ruby::PhaseTimings* timings = nullptr);
+
+  bool isIndexed(QPDFObjGen const& page) const { return m_pages.count(page) > 0; }
+
+  /** Union box of everything painted under `mcid` on `page`, if the page is indexed and has any. */
+  std::optional<BBox> find(QPDFObjGen const& page, int mcid) const;
+
+  /** Entries of `page` whose box intersects `rect`, ordered by MCID. */
+  std::vector<Entry> query(QPDFObjGen const& page, BBox const& rect) const;
+
+  /** Every MCID a BDC opens in the content of `page`, sorted; empty unless the page is indexed. */
+  std::vector<int> const& mcids(QPDFObjGen const& page) const { return tagging(page).mcids; }
+
+  /** What `page` paints outside of MCIDs and artifacts, in content order; empty unless the page is indexed. */
+  std::vector<PDFImageMapper::UntaggedSpan> const& untagged(QPDFObjGen const& page) const {
+    return tagging(page).untagged;
+  }
+
+  struct Node {
+    BBox bbox;
+    uint32_t first;  // index into entries (leaf) or nodes
+    uint32_t count;
+    bool leaf;
+  };
+
+ private:
+  struct PageTree {
+    std::vector<Entry> entries;     // in tree order
+    std::vector<uint32_t> by_mcid;  // entry indices sorted by MCID
+    std::vector<Node> nodes;        // root last
+    PDFImageMapper::PageTagging tagging;
+  };
+
+  PDFImageMapper::PageTagging const& tagging(QPDFObjGen const& page) const;
+
+  static PageTree build(std::map<int, BBox> const& boxes);
+
+  std::map<QPDFObjGen, PageTree> m_pages;
+  PDFImageMapper::FormBBoxCache m_forms;
+};
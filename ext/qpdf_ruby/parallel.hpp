@@ -0,0 +1,76 @@
+#pragma once
+
+#include "without_gvl.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace qpdf_ruby {
+
+/** Most threads worth running at once: the hardware threads, or 8 when that is unknown. */
+inline unsigned max_threads() {
+  unsigned hardware = std::thread::hardware_concurrency();
+  return hardware > 0 ? hardware : 8;
+}
+
+/**
+ * Calls `fn(i)` for every i in [0, count) on up to `threads` threads (at
+ * most max_threads()), the calling thread included. Work is handed out one index at a time, so uneven
+ * items balance themselves. `fn` must not touch QPDF or Ruby objects.
+ *
+ * The first exception thrown by `fn` stops the remaining work and is
+ * rethrown after all helpers have been joined. Helpers honour the
+ * interrupt flag of the surrounding call_without_gvl().
+ */
+template <typename Fn>
+void parallel_for(size_t count, unsigned threads, Fn&& fn) {
+  if (threads <= 1 || count <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      check_interrupts();
+      fn(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  InterruptScope::Flag* interrupt_flag = InterruptScope::current();
+
+  auto worker = [&] {
+    InterruptScope scope(interrupt_flag);
+    try {
+      for (size_t i; !failed.load(std::memory_order_relaxed) && (i = next.fetch_add(1)) < count;) {
+        check_interrupts();
+        fn(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) error = std::current_exception();
+      failed = true;
+    }
+  };
+
+  std::vector<std::thread> helpers;
+  size_t helper_count = std::min<size_t>({threads, max_threads(), count}) - 1;
+  helpers.reserve(helper_count);
+  try {
+    for (size_t t = 0; t < helper_count; ++t) helpers.emplace_back(worker);
+  } catch (std::system_error const&) {
+    // out of threads: carry on with the ones we got
+  }
+
+  worker();
+  for (auto& helper : helpers) helper.join();
+
+  if (error) std::rethrow_exception(error);
+}
+
+}  // namespace qpdf_ruby
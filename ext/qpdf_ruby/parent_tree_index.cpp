@@ -0,0 +1,77 @@
+#include "parent_tree_index.hpp"
+#include "structure_model.hpp"
+#include "without_gvl.hpp"
+
+#include <unordered_set>
+
+ParentTreeIndex ParentTreeIndex::build(QPDF& pdf, size_t max_nodes) {
+  ParentTreeIndex index;
+
+  QPDFObjectHandle struct_root = pdf.getRoot().getKey("/StructTreeRoot");
+  if (!struct_root.isDictionary()) return index;
+  QPDFObjectHandle parent_tree = struct_root.getKey("/ParentTree");
+  if (!parent_tree.isDictionary()) return index;
+
+  auto budget = [&](size_t used) {
+    if (used > max_nodes) {
+      throw StructureLimitExceeded("ParentTree has more than " + std::to_string(max_nodes) + " entries");
+    }
+  };
+
+  // Leaves of the number tree: /StructParents key → array of elements by MCID
+  std::unordered_map<long long, QPDFObjectHandle> arrays;
+  std::vector<QPDFObjectHandle> pending{parent_tree};
+  std::unordered_set<QPDFObjGen, ObjGenHash> visited;  // a /Kids entry pointing back up is skipped
+  size_t used = 0;
+
+  while (!pending.empty()) {
+    qpdf_ruby::check_interrupts();
+
+    QPDFObjectHandle node = pending.back();
+    pending.pop_back();
+    if (!node.isDictionary() || (node.isIndirect() && !visited.insert(node.getObjGen()).second)) continue;
+
+    QPDFObjectHandle nums = node.getKey("/Nums");
+    if (nums.isArray()) {
+      for (int i = 0; i + 1 < nums.getArrayNItems(); i += 2) {
+        QPDFObjectHandle key = nums.getArrayItem(i);
+        QPDFObjectHandle value = nums.getArrayItem(i + 1);
+        if (key.isInteger() && value.isArray()) arrays.emplace(key.getIntValue(), value);
+      }
+      budget(used += nums.getArrayNItems() / 2);
+    }
+
+    QPDFObjectHandle kids = node.getKey("/Kids");
+    if (kids.isArray()) {
+      for (int i = 0; i < kids.getArrayNItems(); ++i) pending.push_back(kids.getArrayItem(i));
+      budget(used += kids.getArrayNItems());
+    }
+  }
+
+  // Pages refer to their array through /StructParents
+  for (QPDFObjectHandle const& page : pdf.getAllPages()) {
+    QPDFObjectHandle key = page.getKey("/StructParents");
+    if (!key.isInteger()) continue;
+    auto it = arrays.find(key.getIntValue());
+    if (it == arrays.end()) continue;
+
+    QPDFObjectHandle const& elements = it->second;
+    size_t begin = index.m_elements.size();
+    budget(used += elements.getArrayNItems());
+    for (int mcid = 0; mcid < elements.getArrayNItems(); ++mcid) {
+      QPDFObjectHandle element = elements.getArrayItem(mcid);
+      index.m_elements.push_back(element.isDictionary() ? element : QPDFObjectHandle::newNull());
+    }
+    index.m_pages[page.getObjGen()] = {begin, index.m_elements.size()};
+  }
+
+  return index;
+}
+
+QPDFObjectHandle ParentTreeIndex::find(QPDFObjGen const& page, int mcid) const {
+  auto it = m_pages.find(page);
+  if (it == m_pages.end() || mcid < 0) return QPDFObjectHandle::newNull();
+
+  size_t i = it->second.first + static_cast<size_t>(mcid);
+  return i < it->second.second ? m_elements[i] : QPDFObjectHandle::newNull();
+}
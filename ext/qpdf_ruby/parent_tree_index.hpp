@@ -0,0 +1,45 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjGen.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+
+#include "pdf_struct_walker.hpp"
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * (page, MCID) → structure element, decoded once from the number tree in
+ * /StructTreeRoot /ParentTree. The elements of each page sit in one flat
+ * array indexed by MCID, so a lookup is a hash probe plus an offset.
+ */
+class ParentTreeIndex {
+ public:
+  /**
+   * Decodes the ParentTree of `pdf` (empty if there is none). Throws
+   * StructureLimitExceeded if the number tree and its arrays hold more
+   * than `max_nodes` entries.
+   */
+  static ParentTreeIndex build(QPDF& pdf, size_t max_nodes);
+
+  /** The element that owns `mcid` on `page`; null if the ParentTree doesn't say. */
+  QPDFObjectHandle find(QPDFObjGen const& page, int mcid) const;
+
+  /** Calls fn(mcid, element) for every MCID on `page` that has an element. */
+  template <typename Fn>
+  void forEach(QPDFObjGen const& page, Fn&& fn) const {
+    auto it = m_pages.find(page);
+    if (it == m_pages.end()) return;
+    for (size_t i = it->second.first; i < it->second.second; ++i) {
+      if (!m_elements[i].isNull()) fn(static_cast<int>(i - it->second.first), m_elements[i]);
+    }
+  }
+
+ private:
+  std::unordered_map<QPDFObjGen, std::pair<size_t, size_t>, ObjGenHash> m_pages;  // [begin, end) in m_elements
+  std::vector<QPDFObjectHandle> m_elements;                                      // null where no element is known
+};
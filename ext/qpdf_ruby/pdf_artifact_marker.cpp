@@ -0,0 +1,185 @@
+#include "pdf_artifact_marker.hpp"
+#include "pdf_content_lexer.hpp"
+#include "without_gvl.hpp"
+#include "parallel.hpp"
+
+#include <qpdf/QPDFPageObjectHelper.hh>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+static constexpr std::string_view ARTIFACT_BEGIN = "/Artifact BMC\n";
+static constexpr std::string_view ARTIFACT_END = "\nEMC";
+
+static bool isPathConstructionOperator(std::string_view op) {
+  return op == "m" || op == "l" || op == "c" || op == "v" || op == "y" || op == "h" || op == "re";
+}
+
+static bool isPaintingOperator(std::string_view op) {
+  return op == "S" || op == "s" || op == "f" || op == "f*" || op == "F" || op == "B" || op == "B*" || op == "b" ||
+         op == "b*" || op == "n";
+}
+
+bool PDFArtifactMarker::rewritePaths(std::string_view in, std::string& out) {
+  PathRewriter rewriter(in, &out);
+  PDFContentLexer lexer(in);
+  PDFContentLexer::Token token;
+  while (lexer.next(token)) rewriter.feed(token);
+  return rewriter.finish();
+}
+
+bool PDFArtifactMarker::wrapSpans(std::string_view in, std::vector<std::pair<size_t, size_t>> const& spans,
+                                  std::string& out) {
+  out.clear();
+  size_t copied = 0;
+  bool changed = false;
+  for (auto const& [begin, end] : spans) {
+    if (begin < copied || end < begin || end > in.size()) continue;  // overlapping or out of range: leave alone
+    out.append(in.substr(copied, begin - copied));
+    out.append(ARTIFACT_BEGIN);
+    out.append(in.substr(begin, end - begin));
+    out.append(ARTIFACT_END);
+    copied = end;
+    changed = true;
+  }
+  out.append(in.substr(copied));
+  return changed;
+}
+
+PDFArtifactMarker::PathRewriter::PathRewriter(std::string_view in, std::string* out) : in(in), out(out) {
+  if (out) {
+    out->clear();
+    out->reserve(in.size() + in.size() / 8);
+  }
+}
+
+bool PDFArtifactMarker::PathRewriter::feed(PDFContentLexer::Token const& token) {
+  if (filled == window.size()) {
+    std::copy(window.begin() + 1, window.end(), window.begin());
+    --filled;
+  }
+  window[filled++] = token;
+
+  if (token.type != PDFContentLexer::TokenType::Operator) return false;
+  // `x y w h re` must be the whole path: in `… re x y w h re f` the second one belongs to a larger path
+  if (token.text == "re") re_starts_path = !in_path;
+  in_path = isPathConstructionOperator(token.text);
+
+  if (filled < window.size() || !isPaintingOperator(token.text) || !window[4].isOperator("re") || !re_starts_path) {
+    return false;
+  }
+
+  bool match = true;
+  for (size_t i = 0; i < 4 && match; ++i) match = window[i].isNumber();
+  // operands and operators must be separated by plain whitespace only
+  for (size_t i = 1; i < window.size() && match; ++i) match = !window[i].after_comment;
+  if (!match) return false;
+
+  if (out) {
+    size_t begin = window[0].offset;
+    size_t end = token.end();
+    out->append(in.substr(copied, begin - copied));
+    out->append(ARTIFACT_BEGIN);
+    out->append(in.substr(begin, end - begin));
+    out->append(ARTIFACT_END);
+    copied = end;
+  }
+  changed = true;
+  filled = 0;  // tokens of a finished match never start another one
+  return true;
+}
+
+bool PDFArtifactMarker::PathRewriter::finish() {
+  if (out) {
+    out->append(in.substr(copied));
+    copied = in.size();
+  }
+  return changed;
+}
+
+PDFArtifactMarker::PDFArtifactMarker(unsigned threads, int compression_level)
+    : threads(std::max(threads, 1u)), compression_level(std::clamp(compression_level, 0, 9)) {}
+
+void PDFArtifactMarker::compress(std::string_view in, int level, std::string& out) {
+  uLongf size = compressBound(in.size());
+  out.resize(size);
+  int rc = compress2(reinterpret_cast<Bytef*>(out.data()), &size, reinterpret_cast<Bytef const*>(in.data()), in.size(),
+                     level);
+  if (rc != Z_OK) throw std::runtime_error("zlib compression failed (" + std::to_string(rc) + ")");
+  out.resize(size);
+}
+
+void PDFArtifactMarker::encode(std::string const& rewritten, std::string& out) const {
+  if (compression_level > 0) compress(rewritten, compression_level, out);
+}
+
+void PDFArtifactMarker::install(QPDFObjectHandle stream, std::string const& rewritten,
+                                std::string const& encoded) const {
+  if (compression_level > 0) {
+    // QPDFWriter copies existing Flate data verbatim, so nothing is compressed twice.
+    stream.replaceStreamData(encoded, QPDFObjectHandle::newName("/FlateDecode"), QPDFObjectHandle::newNull());
+  } else {
+    stream.replaceStreamData(rewritten, QPDFObjectHandle::newNull(), QPDFObjectHandle::newNull());
+  }
+}
+
+void PDFArtifactMarker::markPaths(QPDF& pdf, qpdf_ruby::PhaseTimings* timings) {
+  std::vector<QPDFObjectHandle> const& all_pages = pdf.getAllPages();
+  seen.clear();
+
+  // Batches bound how much decoded stream data is resident at once.
+  size_t batch_size = std::max<size_t>(16, threads * 4);
+  for (size_t begin = 0; begin < all_pages.size(); begin += batch_size) {
+    size_t end = std::min(all_pages.size(), begin + batch_size);
+    markBatch(std::vector<QPDFObjectHandle>(all_pages.begin() + begin, all_pages.begin() + end), timings);
+  }
+}
+
+void PDFArtifactMarker::markBatch(std::vector<QPDFObjectHandle> const& pages, qpdf_ruby::PhaseTimings* timings) {
+  // 1. fetch (serial: QPDF is not thread-safe), each distinct stream once
+  size_t job_count = 0;
+  qpdf_ruby::timed(timings, "read", [&] {
+    for (auto const& page_obj : pages) {
+      qpdf_ruby::check_interrupts();
+
+      QPDFPageObjectHelper poh(page_obj);
+      for (auto& content_stream : poh.getPageContents()) {
+        if (!content_stream.isStream() || !seen.insert(content_stream.getObjGen()).second) continue;
+
+        if (jobs.size() <= job_count) jobs.emplace_back();
+        StreamJob& job = jobs[job_count++];
+        job.stream = content_stream;
+        job.data = content_stream.getStreamData();
+        job.changed = false;
+      }
+    }
+  });
+
+  // 2. transform, then compress (parallel: plain bytes only)
+  qpdf_ruby::timed(timings, "scan", [&] {
+    qpdf_ruby::parallel_for(job_count, threads, [this](size_t i) {
+      StreamJob& job = jobs[i];
+      std::string_view in(reinterpret_cast<char const*>(job.data->getBuffer()), job.data->getSize());
+      job.changed = rewritePaths(in, job.rewritten);
+    });
+  });
+  qpdf_ruby::timed(timings, "compress", [&] {
+    qpdf_ruby::parallel_for(job_count, threads, [this](size_t i) {
+      if (jobs[i].changed) encode(jobs[i].rewritten, jobs[i].compressed);
+    });
+  });
+
+  // 3. install (serial); every page sharing the stream sees the new data
+  qpdf_ruby::timed(timings, "install", [&] {
+    for (size_t i = 0; i < job_count; ++i) {
+      StreamJob& job = jobs[i];
+      if (job.changed) install(job.stream, job.rewritten, job.compressed);
+      job.data.reset();
+      job.stream = QPDFObjectHandle();
+    }
+  });
+}
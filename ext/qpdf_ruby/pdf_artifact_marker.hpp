@@ -0,0 +1,111 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+
+#include "pdf_content_lexer.hpp"
+#include "phase_timings.hpp"
+
+#include <array>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Marks rectangle paths (`x y w h re` followed by a painting operator) as
+ * `/Artifact BMC … EMC`, so assistive technology skips decorative lines,
+ * boxes and backgrounds.
+ */
+class PDFArtifactMarker {
+ public:
+  static constexpr int DEFAULT_COMPRESSION_LEVEL = 6;
+
+  /**
+   * `threads` > 1 rewrites the streams of a batch of pages concurrently.
+   * Rewritten streams are Flate encoded with `compression_level` (1–9) on the
+   * same workers; 0 installs them without a filter, leaving any compression
+   * to QPDFWriter (which by default compresses unfiltered streams on write).
+   */
+  explicit PDFArtifactMarker(unsigned threads = 1, int compression_level = DEFAULT_COMPRESSION_LEVEL);
+
+  /**
+   * Rewrites every page content stream of `pdf`. Stream data is fetched from
+   * and installed into QPDF on the calling thread only; just the text
+   * transformation and compression run on the worker threads.
+   *
+   * Streams are rewritten in place and keyed by object id, so a stream
+   * shared by many pages is processed once, and streams without any
+   * matching path keep their original (still compressed) data.
+   */
+  void markPaths(QPDF& pdf, qpdf_ruby::PhaseTimings* timings = nullptr);
+
+  /**
+   * Pure text transformation of one content stream: copies `in` to `out`
+   * (cleared first, capacity reused) with artifact markers inserted.
+   * Runs in one pass over the tokens; returns false if nothing matched.
+   */
+  static bool rewritePaths(std::string_view in, std::string& out);
+
+  /**
+   * Copies `in` to `out` (cleared first) with each of `spans`, byte ranges
+   * [begin, end) in ascending order, wrapped in /Artifact BMC … EMC.
+   * Returns false if there was nothing to wrap.
+   */
+  static bool wrapSpans(std::string_view in, std::vector<std::pair<size_t, size_t>> const& spans, std::string& out);
+
+  /**
+   * rewritePaths() one token at a time, for callers that lex the stream
+   * anyway. Tokens must be those of `in`, in order. `out` is cleared
+   * first; with a null `out` nothing is copied, but matches are still
+   * reported.
+   */
+  class PathRewriter {
+   public:
+    PathRewriter(std::string_view in, std::string* out);
+
+    /** True if `token` completes a path that is now wrapped as an artifact. */
+    bool feed(PDFContentLexer::Token const& token);
+
+    /** Copies the rest of `in`; returns false if nothing matched. */
+    bool finish();
+
+   private:
+    std::string_view in;
+    std::string* out;
+    std::array<PDFContentLexer::Token, 6> window{};  // `x y w h re <paint>` once a match is complete
+    size_t filled = 0;
+    size_t copied = 0;
+    bool in_path = false;         // the last operator built a path
+    bool re_starts_path = false;  // the last `re` began a new path, rather than adding to one
+    bool changed = false;
+  };
+
+  /** Flate encodes a rewritten stream into `out` at this marker's level; no-op at level 0. */
+  void encode(std::string const& rewritten, std::string& out) const;
+
+  /** Installs a rewritten stream, `encoded` by encode() unless the level is 0. */
+  void install(QPDFObjectHandle stream, std::string const& rewritten, std::string const& encoded) const;
+
+ private:
+  struct StreamJob {
+    QPDFObjectHandle stream;
+    std::shared_ptr<Buffer> data;
+    std::string rewritten;   // capacity is reused by later batches
+    std::string compressed;  // ditto
+    bool changed = false;
+  };
+
+  void markBatch(std::vector<QPDFObjectHandle> const& pages, qpdf_ruby::PhaseTimings* timings);
+
+  static void compress(std::string_view in, int level, std::string& out);
+
+  unsigned threads;
+  int compression_level;
+  std::vector<StreamJob> jobs;
+  std::set<QPDFObjGen> seen;  // streams already queued in this markPaths() run
+};
@@ -0,0 +1,161 @@
+#include "pdf_content_lexer.hpp"
+
+static PDFContentLexer::TokenType classifyRegular(std::string_view text) {
+  using TokenType = PDFContentLexer::TokenType;
+
+  size_t i = 0;
+  if (text[0] == '+' || text[0] == '-') ++i;
+
+  bool digits = false;
+  bool dot = false;
+  for (; i < text.size(); ++i) {
+    char c = text[i];
+    if (c >= '0' && c <= '9') {
+      digits = true;
+    } else if (c == '.' && !dot) {
+      dot = true;
+    } else {
+      digits = false;
+      break;
+    }
+  }
+  if (digits) return dot ? TokenType::Real : TokenType::Integer;
+
+  if (text == "true" || text == "false") return TokenType::Bool;
+  if (text == "null") return TokenType::Null;
+  return TokenType::Operator;
+}
+
+double PDFContentLexer::toNumber(std::string_view text) {
+  size_t i = 0;
+  bool negative = false;
+  if (i < text.size() && (text[i] == '+' || text[i] == '-')) negative = text[i++] == '-';
+
+  double value = 0;
+  for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) value = value * 10 + (text[i] - '0');
+  if (i < text.size() && text[i] == '.') {
+    double scale = 0.1;
+    for (++i; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i, scale *= 0.1) value += (text[i] - '0') * scale;
+  }
+  return negative ? -value : value;
+}
+
+void PDFContentLexer::skipWhitespaceAndComments(bool& saw_comment) {
+  while (pos < data.size()) {
+    unsigned char c = data[pos];
+    if (isWhitespace(c)) {
+      ++pos;
+    } else if (c == '%') {
+      saw_comment = true;
+      while (pos < data.size() && data[pos] != '\n' && data[pos] != '\r') ++pos;
+    } else {
+      break;
+    }
+  }
+}
+
+size_t PDFContentLexer::endOfRegular(size_t from) const {
+  while (from < data.size() && !isWhitespace(data[from]) && !isDelimiter(data[from])) ++from;
+  return from;
+}
+
+size_t PDFContentLexer::endOfLiteralString(size_t from) const {
+  int depth = 0;
+  for (size_t i = from; i < data.size(); ++i) {
+    char c = data[i];
+    if (c == '\\') {
+      ++i;  // skip the escaped character
+    } else if (c == '(') {
+      ++depth;
+    } else if (c == ')' && --depth == 0) {
+      return i + 1;
+    }
+  }
+  return data.size();  // unterminated: swallow the rest
+}
+
+// Inline image data ends at the first "EI" that is preceded by whitespace and
+// followed by whitespace, a delimiter or the end of the stream.
+size_t PDFContentLexer::endOfInlineImageData(size_t from) const {
+  for (size_t i = from; i + 1 < data.size(); ++i) {
+    if (data[i] == 'E' && data[i + 1] == 'I' && i > 0 && isWhitespace(data[i - 1]) &&
+        (i + 2 == data.size() || isWhitespace(data[i + 2]) || isDelimiter(data[i + 2]))) {
+      return i > from ? i - 1 : from;
+    }
+  }
+  return data.size();
+}
+
+bool PDFContentLexer::next(Token& token) {
+  if (pending_inline_image) {
+    pending_inline_image = false;
+    size_t start = pos < data.size() ? pos + 1 : pos;  // exactly one whitespace follows ID
+    size_t end = endOfInlineImageData(start);
+    token.type = TokenType::InlineImageData;
+    token.offset = start;
+    token.text = data.substr(start, end - start);
+    token.after_comment = false;
+    pos = end;
+    return true;
+  }
+
+  bool saw_comment = false;
+  skipWhitespaceAndComments(saw_comment);
+  if (pos >= data.size()) return false;
+
+  size_t start = pos;
+  char c = data[pos];
+  switch (c) {
+    case '(':
+      token.type = TokenType::String;
+      pos = endOfLiteralString(pos);
+      break;
+    case '<':
+      if (pos + 1 < data.size() && data[pos + 1] == '<') {
+        token.type = TokenType::DictOpen;
+        pos += 2;
+      } else {
+        token.type = TokenType::HexString;
+        while (pos < data.size() && data[pos] != '>') ++pos;
+        if (pos < data.size()) ++pos;
+      }
+      break;
+    case '>':
+      if (pos + 1 < data.size() && data[pos + 1] == '>') {
+        token.type = TokenType::DictClose;
+        pos += 2;
+      } else {
+        token.type = TokenType::Bad;
+        ++pos;
+      }
+      break;
+    case '[':
+      token.type = TokenType::ArrayOpen;
+      ++pos;
+      break;
+    case ']':
+      token.type = TokenType::ArrayClose;
+      ++pos;
+      break;
+    case '/':
+      token.type = TokenType::Name;
+      pos = endOfRegular(pos + 1);
+      break;
+    case ')':
+    case '{':
+    case '}':
+      token.type = TokenType::Bad;  // not valid in content streams
+      ++pos;
+      break;
+    default:
+      pos = endOfRegular(pos);
+      token.type = classifyRegular(data.substr(start, pos - start));
+      break;
+  }
+
+  token.offset = start;
+  token.text = data.substr(start, pos - start);
+  token.after_comment = saw_comment;
+  pending_inline_image = token.isOperator("ID");
+  return true;
+}
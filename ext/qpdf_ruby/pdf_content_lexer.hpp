@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Allocation free, single pass lexer for PDF content streams.
+ *
+ * Tokens are views into the input buffer, so the buffer must outlive them.
+ * Whitespace and comments are skipped; `Token::after_comment` tells whether
+ * a comment sat between a token and its predecessor. Inline image data
+ * (`BI … ID <binary> EI`) comes back as one InlineImageData token so binary
+ * bytes are never mistaken for operators.
+ */
+class PDFContentLexer {
+ public:
+  enum class TokenType : uint8_t {
+    Integer,
+    Real,
+    Name,
+    String,     // ( … ) literal, including the parentheses
+    HexString,  // < … >
+    ArrayOpen,
+    ArrayClose,
+    DictOpen,
+    DictClose,
+    Bool,
+    Null,
+    Operator,
+    InlineImageData,
+    Bad,
+  };
+
+  struct Token {
+    TokenType type = TokenType::Bad;
+    std::string_view text;
+    size_t offset = 0;  // of text within the input
+    bool after_comment = false;
+
+    size_t end() const { return offset + text.size(); }
+    bool isNumber() const { return type == TokenType::Integer || type == TokenType::Real; }
+    bool isOperator(std::string_view op) const { return type == TokenType::Operator && text == op; }
+  };
+
+  explicit PDFContentLexer(std::string_view data) : data(data) {}
+
+  /** Reads the next token; returns false at end of input. */
+  bool next(Token& token);
+
+  /** Value of a numeric token (0 for anything else); no allocation, no locale. */
+  static double toNumber(std::string_view text);
+
+  static bool isWhitespace(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\0';
+  }
+  static bool isDelimiter(unsigned char c) {
+    return c == '(' || c == ')' || c == '<' || c == '>' || c == '[' || c == ']' || c == '{' || c == '}' || c == '/' ||
+           c == '%';
+  }
+
+ private:
+  void skipWhitespaceAndComments(bool& saw_comment);
+  size_t endOfRegular(size_t from) const;
+  size_t endOfLiteralString(size_t from) const;
+  size_t endOfInlineImageData(size_t from) const;
+
+  std::string_view data;
+  size_t pos = 0;
+  bool pending_inline_image = false;  // the last token was the ID operator
+};
@@ -1,9 +1,15 @@
 #include "pdf_image_mapper.hpp"
-#include <qpdf/BufferInputSource.hh>
-#include <qpdf/QPDFTokenizer.hh>
+#include "pdf_content_lexer.hpp"
+#include "without_gvl.hpp"
+#include "parallel.hpp"
+#include "pdf_artifact_marker.hpp"
+#include "phase_timings.hpp"
 
 #include <algorithm>
+#include <cctype>
+#include <limits>
 #include <optional>
+#include <string_view>
 
 using Matrix = std::array<double, 6>;
 
@@ -13,6 +19,12 @@ static std::pair<double, double> apply_matrix(const Matrix& m, double x, double
   return {x_new, y_new};
 }
 
+// m × n: apply m first, then n
+static Matrix multiply(const Matrix& m, const Matrix& n) {
+  return {m[0] * n[0] + m[1] * n[2],        m[0] * n[1] + m[1] * n[3],        m[2] * n[0] + m[3] * n[2],
+          m[2] * n[1] + m[3] * n[3],        m[4] * n[0] + m[5] * n[2] + n[4], m[4] * n[1] + m[5] * n[3] + n[5]};
+}
+
 static std::array<double, 4> compute_bbox(double width, double height, const Matrix& matrix) {
   std::array<std::pair<double, double>, 4> corners = {apply_matrix(matrix, 0, 0), apply_matrix(matrix, width, 0),
                                                       apply_matrix(matrix, width, height),
@@ -33,48 +45,21 @@ static std::array<double, 4> compute_bbox(double width, double height, const Mat
   return {min_x, min_y, max_x, max_y};
 }
 
-static char const* tokenTypeName(QPDFTokenizer::token_type_e ttype) {
-  // Do this is a case statement instead of a lookup so the compiler
-  // will warn if we miss any.
-  switch (ttype) {
-    case QPDFTokenizer::tt_bad:
-      return "bad";
-    case QPDFTokenizer::tt_array_close:
-      return "array_close";
-    case QPDFTokenizer::tt_array_open:
-      return "array_open";
-    case QPDFTokenizer::tt_brace_close:
-      return "brace_close";
-    case QPDFTokenizer::tt_brace_open:
-      return "brace_open";
-    case QPDFTokenizer::tt_dict_close:
-      return "dict_close";
-    case QPDFTokenizer::tt_dict_open:
-      return "dict_open";
-    case QPDFTokenizer::tt_integer:
-      return "integer";
-    case QPDFTokenizer::tt_name:
-      return "name";
-    case QPDFTokenizer::tt_real:
-      return "real";
-    case QPDFTokenizer::tt_string:
-      return "string";
-    case QPDFTokenizer::tt_null:
-      return "null";
-    case QPDFTokenizer::tt_bool:
-      return "bool";
-    case QPDFTokenizer::tt_word:
-      return "word";
-    case QPDFTokenizer::tt_eof:
-      return "eof";
-    case QPDFTokenizer::tt_space:
-      return "space";
-    case QPDFTokenizer::tt_comment:
-      return "comment";
-    case QPDFTokenizer::tt_inline_image:
-      return "inline-image";
-  }
-  return nullptr;
+static std::array<double, 4> intersect(std::array<double, 4> const& a, std::array<double, 4> const& b) {
+  return {std::max(a[0], b[0]), std::max(a[1], b[1]), std::min(a[2], b[2]), std::min(a[3], b[3])};
+}
+
+static constexpr std::array<double, 4> UNBOUNDED = {std::numeric_limits<double>::lowest(),
+                                                    std::numeric_limits<double>::lowest(),
+                                                    std::numeric_limits<double>::max(),
+                                                    std::numeric_limits<double>::max()};
+
+// `box` as [llx lly urx ury] whatever corners it names; nullopt unless it is a rectangle
+static std::optional<std::array<double, 4>> read_rectangle(QPDFObjectHandle box) {
+  if (!box.isRectangle()) return std::nullopt;
+  QPDFObjectHandle::Rectangle r = box.getArrayAsRectangle();
+  return std::array<double, 4>{std::min(r.llx, r.urx), std::min(r.lly, r.ury), std::max(r.llx, r.urx),
+                               std::max(r.lly, r.ury)};
 }
 
 static std::optional<ImageInfo> get_image_info(QPDFObjectHandle resources, const std::string& name) {
@@ -115,34 +100,17 @@ static std::optional<ImageInfo> get_image_info(QPDFObjectHandle resources, const
   }
 
   return std::nullopt;
-  ;
-}
-
-PDFImageMapper::PDFImageMapper(int target_mcid) : target_mcid(target_mcid), in_target_mcid(false) {}
-
-void PDFImageMapper::push_cm(double value) {
-  if (cm_fixed_size_queue.size() == 6) {
-    cm_fixed_size_queue.pop_front();  // Remove oldest element
-  }
-  cm_fixed_size_queue.push_back(value);
 }
 
-void PDFImageMapper::find(QPDF& pdf) {
-  QPDFPageDocumentHelper doc_helper(pdf);
-  std::vector<QPDFPageObjectHelper> pages = doc_helper.getAllPages();
-  for (auto& page : pages) {
-    QPDFPageObjectHelper poh(page);
-
-    auto crop_box = poh.getCropBox();
-
-    this->find(poh);
-  }
-}
+PDFImageMapper::PDFImageMapper(int target_mcid, unsigned threads, FormBBoxCache* form_cache)
+    : target_mcid(target_mcid),
+      threads(std::max(threads, 1u)),
+      form_cache(form_cache ? form_cache : &own_form_cache) {}
 
 struct OperatorInfo {
   const char* name;
   const char* description;
-  int operand_count;
+  size_t operand_count;
 };
 
 static constexpr OperatorInfo OPERATOR_CM = {"cm", "Concatenate matrix (set CTM)", 6};
@@ -151,144 +119,821 @@ static constexpr OperatorInfo OPERATOR_Q_UPPER = {"Q", "Restore graphics state",
 static constexpr OperatorInfo OPERATOR_DO = {"Do", "Invoke named XObject (draw image/form)", 1};
 static constexpr OperatorInfo OPERATOR_BDC = {"BDC", "Begin Marked Content sequence with property list", 2};
 static constexpr OperatorInfo OPERATOR_EMC = {"EMC", "End Marked Content sequence", 0};
+static constexpr OperatorInfo OPERATOR_BMC = {"BMC", "Begin Marked Content sequence", 1};
+static constexpr OperatorInfo OPERATOR_BT = {"BT", "Begin text object", 0};
+static constexpr OperatorInfo OPERATOR_TF = {"Tf", "Set text font and size", 2};
+static constexpr OperatorInfo OPERATOR_TL = {"TL", "Set text leading", 1};
+static constexpr OperatorInfo OPERATOR_TD = {"Td", "Move to start of next text line", 2};
+static constexpr OperatorInfo OPERATOR_TD_UPPER = {"TD", "Move text position and set leading", 2};
+static constexpr OperatorInfo OPERATOR_TM = {"Tm", "Set text matrix", 6};
+static constexpr OperatorInfo OPERATOR_T_STAR = {"T*", "Move to start of next text line", 0};
+static constexpr OperatorInfo OPERATOR_TJ = {"Tj", "Show text", 1};
+static constexpr OperatorInfo OPERATOR_TJ_UPPER = {"TJ", "Show text with glyph positioning", 1};
+static constexpr OperatorInfo OPERATOR_QUOTE = {"'", "Next line, show text", 1};
+static constexpr OperatorInfo OPERATOR_DQUOTE = {"\"", "Set spacing, next line, show text", 3};
+
+// Path construction operators and the number of points each adds
+static int path_point_count(std::string_view op) {
+  if (op == "m" || op == "l") return 1;
+  if (op == "c") return 3;
+  if (op == "v" || op == "y") return 2;
+  return 0;
+}
 
-class CMDoExtractor : public QPDFObjectHandle::ParserCallbacks {
- public:
-  explicit CMDoExtractor(QPDFPageObjectHelper& page_ref) : page(page_ref) {
-    // You can add any other initialization logic here if needed
+static bool is_path_painting(std::string_view op) {
+  return op == "S" || op == "s" || op == "f" || op == "F" || op == "f*" || op == "B" || op == "B*" || op == "b" ||
+         op == "b*";
+}
+
+// Text boxes are estimated without font metrics: glyphs are taken as half an
+// em wide, spanning from 0.2 em below to 0.8 em above the baseline.
+static constexpr double GLYPH_WIDTH = 0.5;
+static constexpr double GLYPH_DESCENT = 0.2;
+static constexpr double GLYPH_ASCENT = 0.8;
+
+using TokenType = PDFContentLexer::TokenType;
+using UntaggedSpan = PDFImageMapper::UntaggedSpan;
+
+// A Form XObject as seen from the resources that name it.
+struct FormRef {
+  Matrix matrix;                                // /Matrix, form space -> user space
+  std::optional<std::array<double, 4>> bbox;  // painted area in form space; nullopt if nothing is painted
+};
+
+// Everything CMDoExtractor needs from a page (or a form), read up front so
+// that scanning the content stream itself touches no QPDF objects.
+struct PageSnapshot {
+  std::vector<std::shared_ptr<Buffer>> contents;  // decoded content streams, in order
+  std::map<std::string, ImageInfo, std::less<>> images;  // /XObject name -> width/height of image XObjects
+  std::map<std::string, FormRef, std::less<>> forms;     // /XObject name -> form XObjects
+  std::map<std::string, std::optional<std::array<double, 4>>, std::less<>> shadings;  // /Shading name -> /BBox
+  std::map<std::string, int, std::less<>> property_mcids;  // /Properties name -> /MCID
+  std::set<std::string, std::less<>> two_byte_fonts;      // /Font names of Type0 fonts
+  std::array<double, 4> clip_box = UNBOUNDED;             // CropBox ∩ MediaBox of a page, /BBox of a form
+};
+
+// Nested forms deeper than this are ignored (and so are cycles).
+static constexpr size_t MAX_FORM_DEPTH = 32;
+
+static std::optional<std::array<double, 4>> form_bbox(QPDFObjectHandle form, QPDFObjectHandle inherited_resources,
+                                                      PDFImageMapper::FormBBoxCache& cache,
+                                                      std::vector<QPDFObjGen>& path);
+
+static Matrix read_matrix(QPDFObjectHandle array) {
+  Matrix m = {1, 0, 0, 1, 0, 0};
+  if (array.isArray() && array.getArrayNItems() == 6) {
+    for (int i = 0; i < 6; ++i) {
+      QPDFObjectHandle item = array.getArrayItem(i);
+      if (!item.isNumber()) return {1, 0, 0, 1, 0, 0};
+      m[i] = item.getNumericValue();
+    }
   }
+  return m;
+}
 
-  std::vector<double> current_matrix = {1, 0, 0, 1, 0, 0};
-  std::stack<std::vector<double>> matrix_stack;
-  std::vector<QPDFObjectHandle> operand_stack;
+static void snapshot_resources(QPDFObjectHandle resources, PageSnapshot& snapshot,
+                               PDFImageMapper::FormBBoxCache& form_cache, std::vector<QPDFObjGen>& path) {
+  if (!resources.isDictionary()) return;
 
-  std::stack<int> mcid_stack;
-  int current_mcid;
+  QPDFObjectHandle xobjects = resources.getKey("/XObject");
+  if (xobjects.isDictionary()) {
+    for (auto const& name : xobjects.getKeys()) {
+      if (auto info = get_image_info(resources, name)) {
+        snapshot.images.emplace(name, *info);
+        continue;
+      }
 
-  void handleEOF() override {
-    // No action needed for this example
+      QPDFObjectHandle xobject = xobjects.getKey(name);
+      if (xobject.isStream() && xobject.getDict().getKey("/Subtype").isNameAndEquals("/Form")) {
+        FormRef ref{read_matrix(xobject.getDict().getKey("/Matrix")), form_bbox(xobject, resources, form_cache, path)};
+        snapshot.forms.emplace(name, ref);
+      }
+    }
   }
 
-  std::optional<ImageInfo> image_info(std::string imgName) {
-    QPDFObjectHandle resources = page.getObjectHandle().getKey("/Resources");
+  QPDFObjectHandle shadings = resources.getKey("/Shading");
+  if (shadings.isDictionary()) {
+    for (auto const& [name, shading] : shadings.getDictAsMap()) {
+      // types 4 to 7 are streams; the optional /BBox is in shading space, i.e. user space at `sh`
+      QPDFObjectHandle dict = shading.isStream() ? shading.getDict() : shading;
+      if (dict.isDictionary()) snapshot.shadings.emplace(name, read_rectangle(dict.getKey("/BBox")));
+    }
+  }
 
-    return get_image_info(resources, imgName);
+  QPDFObjectHandle fonts = resources.getKey("/Font");
+  if (fonts.isDictionary()) {
+    for (auto const& [name, font] : fonts.getDictAsMap()) {
+      if (font.isDictionary() && font.getKey("/Subtype").isNameAndEquals("/Type0")) {
+        snapshot.two_byte_fonts.insert(name);
+      }
+    }
   }
 
-  void handleObject(QPDFObjectHandle obj, size_t offset, size_t length) override {
-    if (obj.isOperator()) {
-      std::string op = obj.getOperatorValue();
+  QPDFObjectHandle properties = resources.getKey("/Properties");
+  if (properties.isDictionary()) {
+    for (auto const& [name, props] : properties.getDictAsMap()) {
+      if (props.isDictionary() && props.hasKey("/MCID") && props.getKey("/MCID").isInteger()) {
+        snapshot.property_mcids.emplace(name, props.getKey("/MCID").getIntValue());
+      }
+    }
+  }
+}
 
-      if (op == OPERATOR_CM.name && operand_stack.size() >= OPERATOR_CM.operand_count) {
-        auto numeric_at = [&](std::size_t distance_from_top) -> double {
-          auto& obj = operand_stack[operand_stack.size() - distance_from_top];
-          auto t = obj.getTypeName();  // "integer", "real", …
-          if (std::strcmp(t, "integer") != 0 && std::strcmp(t, "real") != 0) {
-            std::stringstream ss;
-            ss << "numeric operand expected (got " << t << ")";
-            throw std::runtime_error(ss.str());
-          }
-          return obj.getNumericValue();
-        };
-
-        // pull operands (top of stack is distance 1)
-        double f = numeric_at(1);
-        double e = numeric_at(2);
-        double d = numeric_at(3);
-        double c = numeric_at(4);
-        double b = numeric_at(5);
-        double a = numeric_at(6);
-        current_matrix = {a, b, c, d, e, f};
-
-        operand_stack.resize(operand_stack.size() - 6);
-      } else if (op == OPERATOR_Q.name) {
-        matrix_stack.push(current_matrix);
-      } else if (op == OPERATOR_Q_UPPER.name) {
-        if (!matrix_stack.empty()) {
-          current_matrix = matrix_stack.top();
-          matrix_stack.pop();
-        }
-      } else if (op == OPERATOR_BDC.name && operand_stack.size() >= OPERATOR_BDC.operand_count) {
-        mcid_stack.push(current_mcid);  // Save current MCID
+// `streams` are the page's content streams, as from getPageContents().
+static PageSnapshot snapshot_page(QPDFPageObjectHelper& page, std::vector<QPDFObjectHandle>& streams,
+                                  PDFImageMapper::FormBBoxCache& form_cache) {
+  PageSnapshot snapshot;
 
-        QPDFObjectHandle properties_obj = operand_stack.back();  // Properties operand
-        // QPDFObjectHandle tag_obj = operand_stack[operand_stack.size() - 2]; // Tag operand
+  for (auto& stream : streams) snapshot.contents.push_back(stream.getStreamData(qpdf_dl_generalized));
 
-        int mcid_val = -1;  // Default if MCID not found or not an integer
-        if (properties_obj.isDictionary()) {
-          if (properties_obj.hasKey("/MCID") && properties_obj.getKey("/MCID").isInteger()) {
-            mcid_val = properties_obj.getKey("/MCID").getIntValue();
-          }
-        } else if (properties_obj.isName()) {
-          // Properties is a name, look it up in Resources /Properties dictionary
-          QPDFObjectHandle resources = page.getObjectHandle().getKey("/Resources");
-          if (resources.isDictionary() && resources.hasKey("/Properties")) {
-            QPDFObjectHandle properties_dict = resources.getKey("/Properties");
-            if (properties_dict.isDictionary() && properties_dict.hasKey(properties_obj.getName())) {
-              QPDFObjectHandle actual_props = properties_dict.getKey(properties_obj.getName());
-              if (actual_props.isDictionary() && actual_props.hasKey("/MCID") &&
-                  actual_props.getKey("/MCID").isInteger()) {
-                mcid_val = actual_props.getKey("/MCID").getIntValue();
-              }
-            }
-          }
-        }
-        current_mcid = mcid_val;
-        operand_stack.resize(operand_stack.size() - OPERATOR_BDC.operand_count);
-      } else if (op == OPERATOR_EMC.name) {  // EMC takes 0 operands
-        if (!mcid_stack.empty()) {
-          current_mcid = mcid_stack.top();
-          mcid_stack.pop();
+  QPDFObjectHandle page_obj = page.getObjectHandle();
+  std::vector<QPDFObjGen> path;
+  snapshot_resources(page_obj.getKey("/Resources"), snapshot, form_cache, path);
+
+  // Both boxes may be inherited from the page tree; the CropBox defaults to the MediaBox.
+  if (auto media_box = read_rectangle(page.getMediaBox())) snapshot.clip_box = *media_box;
+  if (auto crop_box = read_rectangle(page.getCropBox())) snapshot.clip_box = intersect(snapshot.clip_box, *crop_box);
+
+  return snapshot;
+}
+
+// Content stream names may contain #xx escapes; QPDF dictionary keys are decoded.
+static std::string_view normalize_name(std::string_view raw, std::string& scratch) {
+  if (raw.find('#') == std::string_view::npos) return raw;
+
+  auto hex = [](char c) -> int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+
+  scratch.clear();
+  for (size_t i = 0; i < raw.size(); ++i) {
+    if (raw[i] == '#' && i + 2 < raw.size() && hex(raw[i + 1]) >= 0 && hex(raw[i + 2]) >= 0) {
+      scratch.push_back(static_cast<char>(hex(raw[i + 1]) * 16 + hex(raw[i + 2])));
+      i += 2;
+    } else {
+      scratch.push_back(raw[i]);
+    }
+  }
+  return scratch;
+}
+
+static char const* operand_type_name(TokenType type) {
+  switch (type) {
+    case TokenType::Integer:
+      return "integer";
+    case TokenType::Real:
+      return "real";
+    case TokenType::Name:
+      return "name";
+    case TokenType::String:
+    case TokenType::HexString:
+      return "string";
+    case TokenType::ArrayOpen:
+      return "array";
+    case TokenType::DictOpen:
+      return "dictionary";
+    case TokenType::Bool:
+      return "boolean";
+    case TokenType::Null:
+      return "null";
+    case TokenType::InlineImageData:
+      return "inline-image";
+    default:
+      return "unresolved";
+  }
+}
+
+/**
+ * Walks a page's content stream token by token and records, per image
+ * XObject, the matrix and marked content id it is drawn with, plus the union
+ * of everything painted (images, inline images, shadings, paths, text) under
+ * each MCID. Along the way it notes every MCID a BDC opens and every object
+ * painted outside of both MCIDs and artifacts. Operands are kept as views
+ * into the content buffer; only the few operators below ever look at them.
+ */
+class CMDoExtractor {
+ public:
+  explicit CMDoExtractor(PageSnapshot const& page) : page(page) { gs.clip = page.clip_box; }
+
+  void scan() {
+    for (auto const& data : page.contents) {
+      scan(content_view(*data), [](PDFContentLexer::Token const&) { return false; });
+    }
+  }
+
+  /**
+   * Scans one content stream of the page; the streams must come in order.
+   * `is_artifact(token)` sees every token first: returning true has that
+   * (painting) operator taken as if it were wrapped in /Artifact BMC … EMC.
+   */
+  template <typename ArtifactFilter>
+  void scan(std::string_view content, ArtifactFilter&& is_artifact) {
+    PDFContentLexer lexer(content);
+    PDFContentLexer::Token token;
+    size_t stream = stream_count++;
+
+    while (lexer.next(token)) {
+      bool artifact = is_artifact(token);
+      if (composite_depth > 0) {
+        addToComposite(token);
+      } else if (token.type == TokenType::ArrayOpen || token.type == TokenType::DictOpen) {
+        if (operand_stack.empty()) operands_begin = {stream, token.offset};
+        composite = Operand{token.type, token.text, -1, 0};
+        composite_depth = 1;
+        composite_items = 0;
+        mcid_key = false;
+      } else if (token.type == TokenType::Operator) {
+        op_begin = operand_stack.empty() ? Position{stream, token.offset} : operands_begin;
+        op_end = {stream, token.end()};
+        if (artifact) {
+          int enclosing_mcid = current_mcid;
+          current_mcid = ARTIFACT_MCID;
+          handleOperator(token.text);
+          current_mcid = enclosing_mcid;
         } else {
-          current_mcid = -1;  // Reset to default if stack underflow (should be balanced)
+          handleOperator(token.text);
         }
-        // EMC takes 0 operands, so no change to operand_stack based on operand_count
-      } else if (op == OPERATOR_DO.name && !operand_stack.empty()) {
-        std::string imgName = operand_stack.back().getName();
-        auto image_info = this->image_info(imgName);
+      } else {
+        if (operand_stack.empty()) operands_begin = {stream, token.offset};
+        operand_stack.push_back(Operand{token.type, token.text, -1, glyphAdvance(token)});
+      }
+    }
+  }
 
-        std::copy(current_matrix.begin(), current_matrix.end(), image_info->cm_matrix.begin());
+  static std::string_view content_view(Buffer const& data) {
+    return {reinterpret_cast<char const*>(data.getBuffer()), data.getSize()};
+  }
 
-        image_info->mcid = current_mcid;
+  const std::map<std::string, ImageInfo>& getImageMap() const { return image_to_mcid; }
+  const PDFImageMapper::McidBBoxes& getMcidBBoxes() const { return mcid_bboxes; }
+  // Union of everything painted outside of artifacts, whatever its MCID
+  const std::optional<std::array<double, 4>>& getPaintedBBox() const { return painted_bbox; }
+
+  PDFImageMapper::PageTagging takeTagging() {
+    std::sort(tagging.mcids.begin(), tagging.mcids.end());
+    tagging.mcids.erase(std::unique(tagging.mcids.begin(), tagging.mcids.end()), tagging.mcids.end());
+    return std::move(tagging);
+  }
 
-        image_info->bbox = compute_bbox(image_info->width, image_info->height, image_info->cm_matrix);
+ private:
+  // Where a token starts or ends: (index of the content stream, byte offset)
+  struct Position {
+    size_t stream = 0;
+    size_t offset = 0;
+  };
+
+  struct Operand {
+    TokenType type;  // ArrayOpen / DictOpen stand for a whole array / dictionary
+    std::string_view text;
+    int mcid;        // /MCID of an inline property dictionary, -1 otherwise
+    double advance;  // estimated width in em of a string, or of a TJ array
+  };
+
+  double glyphAdvance(PDFContentLexer::Token const& token) const {
+    size_t bytes = 0;
+    if (token.type == TokenType::String) {
+      for (size_t i = 1; i + 1 < token.text.size(); ++i, ++bytes) {
+        if (token.text[i] != '\\') continue;
+        // an escape counts as one byte: \n, \(, … or up to three octal digits
+        size_t digits = 0;
+        while (digits < 3 && i + 2 < token.text.size() && token.text[i + 1] >= '0' && token.text[i + 1] <= '7') {
+          ++i;
+          ++digits;
+        }
+        if (digits == 0) ++i;
+      }
+    } else if (token.type == TokenType::HexString) {
+      for (char c : token.text) bytes += std::isxdigit(static_cast<unsigned char>(c)) ? 1 : 0;
+      bytes = (bytes + 1) / 2;
+    } else {
+      return 0;
+    }
+    return GLYPH_WIDTH * static_cast<double>(two_byte_font ? bytes / 2 : bytes);
+  }
 
-        QPDFObjectHandle mb = page.getObjectHandle().getKey("/MediaBox");
+  // Arrays and dictionaries are single operands; only a direct /MCID entry
+  // and the text advance of a TJ array matter.
+  void addToComposite(PDFContentLexer::Token const& token) {
+    bool opens = token.type == TokenType::ArrayOpen || token.type == TokenType::DictOpen;
+    bool closes = token.type == TokenType::ArrayClose || token.type == TokenType::DictClose;
+
+    if (composite_depth == 1 && composite.type == TokenType::DictOpen && !closes) {
+      bool is_key = composite_items++ % 2 == 0;
+      if (is_key) {
+        mcid_key = token.type == TokenType::Name && normalize_name(token.text, name_scratch) == "/MCID";
+      } else if (mcid_key && token.type == TokenType::Integer) {
+        composite.mcid = static_cast<int>(PDFContentLexer::toNumber(token.text));
+      }
+    } else if (composite_depth == 1 && composite.type == TokenType::ArrayOpen) {
+      if (token.isNumber()) {
+        composite.advance -= PDFContentLexer::toNumber(token.text) / 1000;
+      } else {
+        composite.advance += glyphAdvance(token);
+      }
+    }
 
-        double px0 = mb.getArrayItem(0).getNumericValue();
-        double py0 = mb.getArrayItem(1).getNumericValue();
-        double px1 = mb.getArrayItem(2).getNumericValue();
-        double py1 = mb.getArrayItem(3).getNumericValue();
+    if (opens) {
+      ++composite_depth;
+    } else if (closes && --composite_depth == 0) {
+      operand_stack.push_back(composite);
+    }
+  }
 
-        auto& bb = image_info->bbox;   // shorthand reference
-        bb[0] = std::max(bb[0], px0);  // left  edge
-        bb[1] = std::max(bb[1], py0);  // bottom edge
-        bb[2] = std::min(bb[2], px1);  // right edge
-        bb[3] = std::min(bb[3], py1);  // top   edge
+  double numericAt(size_t distance_from_top) const {
+    Operand const& operand = operand_stack[operand_stack.size() - distance_from_top];
+    if (operand.type != TokenType::Integer && operand.type != TokenType::Real) {
+      std::stringstream ss;
+      ss << "numeric operand expected (got " << operand_type_name(operand.type) << ")";
+      throw std::runtime_error(ss.str());
+    }
+    return PDFContentLexer::toNumber(operand.text);
+  }
 
-        image_to_mcid[imgName] = *image_info;
+  // The `count` topmost operands as numbers, or false if they are not all numeric.
+  bool topNumbers(size_t count, double* out) const {
+    if (operand_stack.size() < count) return false;
+    for (size_t i = 0; i < count; ++i) {
+      Operand const& operand = operand_stack[operand_stack.size() - count + i];
+      if (operand.type != TokenType::Integer && operand.type != TokenType::Real) return false;
+      out[i] = PDFContentLexer::toNumber(operand.text);
+    }
+    return true;
+  }
 
-        operand_stack.pop_back();
+  void handleOperator(std::string_view op) {
+    if (op == OPERATOR_CM.name && operand_stack.size() >= OPERATOR_CM.operand_count) {
+      // pull operands (top of stack is distance 1)
+      double f = numericAt(1);
+      double e = numericAt(2);
+      double d = numericAt(3);
+      double c = numericAt(4);
+      double b = numericAt(5);
+      double a = numericAt(6);
+      gs.ctm = multiply({a, b, c, d, e, f}, gs.ctm);
+
+      operand_stack.resize(operand_stack.size() - OPERATOR_CM.operand_count);
+    } else if (op == OPERATOR_Q.name) {
+      gs_stack.push_back(gs);
+    } else if (op == OPERATOR_Q_UPPER.name) {
+      if (!gs_stack.empty()) {
+        gs = gs_stack.back();
+        gs_stack.pop_back();
+      }
+    } else if (op == OPERATOR_BDC.name && operand_stack.size() >= OPERATOR_BDC.operand_count) {
+      mcid_stack.push_back(current_mcid);  // Save current MCID
+
+      Operand const& tag = operand_stack[operand_stack.size() - 2];
+      Operand const& properties = operand_stack.back();
+
+      int mcid_val = -1;  // Default if MCID not found or not an integer
+      if (properties.type == TokenType::DictOpen) {
+        mcid_val = properties.mcid;
+      } else if (properties.type == TokenType::Name) {
+        // Properties is a name, look it up in Resources /Properties dictionary
+        auto it = page.property_mcids.find(normalize_name(properties.text, name_scratch));
+        if (it != page.property_mcids.end()) mcid_val = it->second;
+      }
+      if (mcid_val >= 0 && !isArtifactTag(tag)) tagging.mcids.push_back(mcid_val);
+      // Sequences without an MCID (/Span /ActualText, optional content, …) stay part of the enclosing one
+      if (isArtifactTag(tag)) {
+        mcid_val = ARTIFACT_MCID;
+      } else if (mcid_val < 0) {
+        mcid_val = current_mcid;
+      }
+      current_mcid = mcid_val;
+      operand_stack.resize(operand_stack.size() - OPERATOR_BDC.operand_count);
+    } else if (op == OPERATOR_BMC.name && !operand_stack.empty()) {
+      mcid_stack.push_back(current_mcid);
+      if (isArtifactTag(operand_stack.back())) current_mcid = ARTIFACT_MCID;
+      operand_stack.pop_back();
+    } else if (op == OPERATOR_EMC.name) {  // EMC takes 0 operands
+      if (!mcid_stack.empty()) {
+        current_mcid = mcid_stack.back();
+        mcid_stack.pop_back();
       } else {
-        // For other operators, just clear the operand stack
-        operand_stack.clear();
+        current_mcid = -1;  // Reset to default if stack underflow (should be balanced)
       }
+    } else if (op == OPERATOR_DO.name && !operand_stack.empty()) {
+      Operand const& name = operand_stack.back();
+      if (name.type == TokenType::Name) {
+        std::string_view xobject = normalize_name(name.text, name_scratch);
+        recordImage(xobject);
+        recordForm(xobject);
+      }
+      operand_stack.pop_back();
     } else {
-      operand_stack.push_back(obj);
+      handlePathOrTextOperator(op);
+      // For other operators, just clear the operand stack
+      operand_stack.clear();
     }
   }
 
-  const std::map<std::string, ImageInfo>& getImageMap() const { return image_to_mcid; }
+  static bool isArtifactTag(Operand const& tag) { return tag.type == TokenType::Name && tag.text == "/Artifact"; }
 
- private:
-  QPDFPageObjectHelper& page;
+  void handlePathOrTextOperator(std::string_view op) {
+    double n[6];
+    if (int points = path_point_count(op); points > 0) {
+      if (path_empty) path_begin = op_begin;
+      if (topNumbers(points * 2, n)) {
+        for (int i = 0; i < points; ++i) addPathPoint(n[2 * i], n[2 * i + 1]);
+      }
+    } else if (op == "re") {
+      if (path_empty) path_begin = op_begin;
+      if (topNumbers(4, n)) {
+        addPathPoint(n[0], n[1]);
+        addPathPoint(n[0] + n[2], n[1]);
+        addPathPoint(n[0] + n[2], n[1] + n[3]);
+        addPathPoint(n[0], n[1] + n[3]);
+      }
+    } else if (is_path_painting(op) || op == "n") {
+      if (!path_empty && op != "n") paint(UntaggedSpan::Path, path_begin, path_bbox);
+      // W / W* take effect once the path is ended, i.e. after it has been painted
+      if (clip_pending && !path_empty) gs.clip = intersect(gs.clip, path_bbox);
+      clip_pending = false;
+      path_empty = true;
+    } else if (op == "W" || op == "W*") {
+      clip_pending = true;
+    } else if (op == "BI") {
+      inline_image_begin = op_begin;
+    } else if (op == "EI") {
+      // BI … ID <data> EI: like an image XObject, an inline image fills the unit square
+      if (!operand_stack.empty() && operand_stack.back().type == TokenType::InlineImageData) {
+        paint(UntaggedSpan::InlineImage, inline_image_begin, compute_bbox(1, 1, gs.ctm));
+      }
+    } else if (op == "sh") {
+      if (!operand_stack.empty() && operand_stack.back().type == TokenType::Name) {
+        recordShading(normalize_name(operand_stack.back().text, name_scratch));
+      }
+    } else if (op == OPERATOR_BT.name) {
+      text_matrix = line_matrix = {1, 0, 0, 1, 0, 0};
+    } else if (op == OPERATOR_TF.name) {
+      if (operand_stack.size() >= OPERATOR_TF.operand_count && topNumbers(1, n)) {
+        Operand const& font = operand_stack[operand_stack.size() - 2];
+        font_size = n[0];
+        two_byte_font = font.type == TokenType::Name &&
+                        page.two_byte_fonts.count(normalize_name(font.text, name_scratch)) > 0;
+      }
+    } else if (op == OPERATOR_TL.name) {
+      if (topNumbers(1, n)) leading = n[0];
+    } else if (op == OPERATOR_TD.name || op == OPERATOR_TD_UPPER.name) {
+      if (topNumbers(2, n)) {
+        if (op == OPERATOR_TD_UPPER.name) leading = -n[1];
+        nextLine(n[0], n[1]);
+      }
+    } else if (op == OPERATOR_TM.name) {
+      if (topNumbers(6, n)) text_matrix = line_matrix = {n[0], n[1], n[2], n[3], n[4], n[5]};
+    } else if (op == OPERATOR_T_STAR.name) {
+      nextLine(0, -leading);
+    } else if (op == OPERATOR_TJ.name || op == OPERATOR_TJ_UPPER.name) {
+      if (!operand_stack.empty()) showText(operand_stack.back().advance);
+    } else if (op == OPERATOR_QUOTE.name || op == OPERATOR_DQUOTE.name) {
+      nextLine(0, -leading);
+      if (!operand_stack.empty()) showText(operand_stack.back().advance);
+    }
+  }
+
+  void addPathPoint(double x, double y) {
+    auto [px, py] = apply_matrix(gs.ctm, x, y);
+    if (path_empty) {
+      path_bbox = {px, py, px, py};
+      path_empty = false;
+    } else {
+      path_bbox = {std::min(path_bbox[0], px), std::min(path_bbox[1], py), std::max(path_bbox[2], px),
+                   std::max(path_bbox[3], py)};
+    }
+  }
+
+  void nextLine(double tx, double ty) {
+    line_matrix = multiply({1, 0, 0, 1, tx, ty}, line_matrix);
+    text_matrix = line_matrix;
+  }
+
+  void showText(double advance_em) {
+    double width = advance_em * font_size;
+    Matrix rendering = multiply(text_matrix, gs.ctm);
+    Matrix glyphs = multiply({1, 0, 0, 1, 0, -GLYPH_DESCENT * font_size}, rendering);
+    if (width != 0 || font_size != 0) {
+      paint(UntaggedSpan::Text, op_begin, compute_bbox(width, (GLYPH_ASCENT + GLYPH_DESCENT) * font_size, glyphs));
+    }
+    text_matrix = multiply({1, 0, 0, 1, width, 0}, text_matrix);
+  }
+
+  // A form is painted as its memoized local box mapped through /Matrix and the CTM.
+  void recordForm(std::string_view form_name) {
+    auto it = page.forms.find(form_name);
+    if (it == page.forms.end() || !it->second.bbox) return;
+
+    auto const& b = *it->second.bbox;
+    Matrix to_user = multiply(it->second.matrix, gs.ctm);
+    Matrix placed = multiply({1, 0, 0, 1, b[0], b[1]}, to_user);
+    paint(UntaggedSpan::Form, op_begin, compute_bbox(b[2] - b[0], b[3] - b[1], placed));
+  }
+
+  // `sh` fills the current clip, or the part of it inside the shading's /BBox.
+  void recordShading(std::string_view shading_name) {
+    auto it = page.shadings.find(shading_name);
+    if (it == page.shadings.end()) return;
+
+    if (auto const& b = it->second) {
+      paint(UntaggedSpan::Shading, op_begin,
+            compute_bbox((*b)[2] - (*b)[0], (*b)[3] - (*b)[1], multiply({1, 0, 0, 1, (*b)[0], (*b)[1]}, gs.ctm)));
+    } else if (gs.clip != UNBOUNDED) {
+      paint(UntaggedSpan::Shading, op_begin, gs.clip);
+    }
+  }
+
+  // Paints the object that began at `begin` and ends with the current operator.
+  void paint(UntaggedSpan::Kind kind, Position begin, std::array<double, 4> bbox) {
+    auto painted = addToMcid(bbox);
+    if (painted && current_mcid == -1) {
+      tagging.untagged.push_back({kind, begin.stream, begin.offset, op_end.stream, op_end.offset, *painted});
+    }
+  }
+
+  // Grows the current MCID's box (and the painted area) by `bbox`, clipped to the current clip.
+  // Returns the clipped box, or nullopt if nothing outside of an artifact was painted.
+  std::optional<std::array<double, 4>> addToMcid(std::array<double, 4> bbox) {
+    if (current_mcid == ARTIFACT_MCID) return std::nullopt;
+
+    bbox = intersect(bbox, gs.clip);
+    if (bbox[0] > bbox[2] || bbox[1] > bbox[3]) return std::nullopt;  // entirely clipped away
+
+    painted_bbox = painted_bbox ? unite(*painted_bbox, bbox) : bbox;
+    if (current_mcid >= 0) {
+      auto [it, inserted] = mcid_bboxes.emplace(current_mcid, bbox);
+      if (!inserted) it->second = unite(it->second, bbox);
+    }
+    return bbox;
+  }
+
+  static std::array<double, 4> unite(std::array<double, 4> const& u, std::array<double, 4> const& bbox) {
+    return {std::min(u[0], bbox[0]), std::min(u[1], bbox[1]), std::max(u[2], bbox[2]), std::max(u[3], bbox[3])};
+  }
+
+  void recordImage(std::string_view img_name) {
+    auto it = page.images.find(img_name);
+    if (it == page.images.end()) return;  // form XObject or missing resource
+
+    ImageInfo image_info = it->second;
+    image_info.cm_matrix = gs.ctm;
+    image_info.mcid = current_mcid;
+    // an image fills the unit square of its CTM, whatever its pixel size
+    image_info.bbox = intersect(compute_bbox(1, 1, image_info.cm_matrix), gs.clip);
+
+    image_to_mcid[std::string(img_name)] = image_info;
+    paint(UntaggedSpan::Image, op_begin, image_info.bbox);
+  }
+
+  PageSnapshot const& page;
+
+  // The parts of the graphics state that decide where things land; the clip
+  // is kept as a box in user space (the bounds of the clipping path).
+  struct GraphicsState {
+    Matrix ctm = {1, 0, 0, 1, 0, 0};
+    std::array<double, 4> clip = UNBOUNDED;
+  };
+
+  GraphicsState gs;
+  std::vector<GraphicsState> gs_stack;
+  bool clip_pending = false;  // W / W* seen, applies when the path ends
+  std::vector<Operand> operand_stack;
+
+  std::vector<int> mcid_stack;
+  int current_mcid = -1;
+
+  static constexpr int ARTIFACT_MCID = -2;  // inside /Artifact: painted, but not part of any MCID
+
+  size_t stream_count = 0;
+  Position operands_begin;      // first operand still on the stack
+  Position op_begin, op_end;    // the operator being handled, with its operands
+  Position path_begin;          // first construction operator of the current path
+  Position inline_image_begin;  // the last BI
+
+  bool path_empty = true;
+  std::array<double, 4> path_bbox = {0, 0, 0, 0};
+
+  Matrix text_matrix = {1, 0, 0, 1, 0, 0};
+  Matrix line_matrix = {1, 0, 0, 1, 0, 0};
+  double font_size = 0;
+  double leading = 0;
+  bool two_byte_font = false;
+
+  Operand composite{TokenType::Bad, {}, -1, 0};
+  int composite_depth = 0;
+  size_t composite_items = 0;
+  bool mcid_key = false;
+
+  std::string name_scratch;
   std::map<std::string, ImageInfo> image_to_mcid;
+  PDFImageMapper::McidBBoxes mcid_bboxes;
+  std::optional<std::array<double, 4>> painted_bbox;
+  PDFImageMapper::PageTagging tagging;
 };
 
+// Painted area of `form` in form space, clipped to its /BBox. Memoized per
+// object id, so a form reused all over the document is only parsed once.
+static std::optional<std::array<double, 4>> form_bbox(QPDFObjectHandle form, QPDFObjectHandle inherited_resources,
+                                                      PDFImageMapper::FormBBoxCache& cache,
+                                                      std::vector<QPDFObjGen>& path) {
+  QPDFObjGen og = form.getObjGen();
+  if (auto it = cache.find(og); it != cache.end()) return it->second;
+  if (path.size() >= MAX_FORM_DEPTH || std::find(path.begin(), path.end(), og) != path.end()) return std::nullopt;
+
+  QPDFObjectHandle dict = form.getDict();
+  PageSnapshot snapshot;
+  try {
+    snapshot.contents.push_back(form.getStreamData(qpdf_dl_generalized));
+  } catch (std::exception const&) {
+    return cache[og] = std::nullopt;  // undecodable: nothing we can measure
+  }
+
+  // Forms without /Resources use those of the page (or form) invoking them.
+  QPDFObjectHandle resources = dict.getKey("/Resources");
+  path.push_back(og);
+  snapshot_resources(resources.isDictionary() ? resources : inherited_resources, snapshot, cache, path);
+  path.pop_back();
+
+  if (auto bbox = read_rectangle(dict.getKey("/BBox"))) snapshot.clip_box = *bbox;
+
+  CMDoExtractor cb(snapshot);
+  cb.scan();
+  return cache[og] = cb.getPaintedBBox();
+}
+
 void PDFImageMapper::find(QPDFPageObjectHelper& page) {
-  CMDoExtractor cb(page);
-  page.parseContents(&cb);
+  std::vector<QPDFObjectHandle> streams = page.getPageContents();
+  PageSnapshot snapshot = snapshot_page(page, streams, *form_cache);
+
+  CMDoExtractor cb(snapshot);
+  cb.scan();
 
   const auto& extracted_map = cb.getImageMap();
   image_to_mcid.insert(extracted_map.begin(), extracted_map.end());
+  page_mcid_bboxes[page.getObjectHandle().getObjGen()] = cb.getMcidBBoxes();
+  page_tagging[page.getObjectHandle().getObjGen()] = cb.takeTagging();
+}
+
+void PDFImageMapper::find(QPDF& pdf) {
+  QPDFPageDocumentHelper doc_helper(pdf);
+  std::vector<QPDFPageObjectHelper> pages = doc_helper.getAllPages();
+  scan(pages, Rewrite::None, nullptr, nullptr);
+}
+
+void PDFImageMapper::find(QPDF& pdf, const std::set<QPDFObjGen>& only_pages, qpdf_ruby::PhaseTimings* timings) {
+  QPDFPageDocumentHelper doc_helper(pdf);
+  std::vector<QPDFPageObjectHelper> pages = doc_helper.getAllPages();
+  pages.erase(std::remove_if(pages.begin(), pages.end(),
+                             [&](QPDFPageObjectHelper& page) {
+                               return only_pages.count(page.getObjectHandle().getObjGen()) == 0;
+                             }),
+              pages.end());
+  scan(pages, Rewrite::None, nullptr, timings);
+}
+
+void PDFImageMapper::findAndMarkPaths(QPDF& pdf, PDFArtifactMarker const& marker, qpdf_ruby::PhaseTimings* timings) {
+  QPDFPageDocumentHelper doc_helper(pdf);
+  std::vector<QPDFPageObjectHelper> pages = doc_helper.getAllPages();
+  scan(pages, Rewrite::Paths, &marker, timings);
+}
+
+void PDFImageMapper::findAndMarkUntagged(QPDF& pdf, PDFArtifactMarker const& marker,
+                                         qpdf_ruby::PhaseTimings* timings) {
+  QPDFPageDocumentHelper doc_helper(pdf);
+  std::vector<QPDFPageObjectHelper> pages = doc_helper.getAllPages();
+  scan(pages, Rewrite::Untagged, &marker, timings);
+}
+
+// A content stream rewritten by findAndMarkPaths() or findAndMarkUntagged(), on behalf of the first page showing it.
+struct RewriteJob {
+  QPDFObjectHandle stream;
+  size_t page = 0;     // index of that page in the batch
+  size_t content = 0;  // index of the stream among the page's contents
+  std::string rewritten;
+  std::string encoded;
+  bool changed = false;
+};
+
+void PDFImageMapper::scan(std::vector<QPDFPageObjectHelper>& pages, Rewrite rewrite, PDFArtifactMarker const* marker,
+                          qpdf_ruby::PhaseTimings* timings) {
+  // Batches bound how much page content is resident at once.
+  size_t batch_size = std::max<size_t>(16, threads * 4);
+  std::vector<PageSnapshot> snapshots;
+  std::vector<std::map<std::string, ImageInfo>> page_maps;
+  std::vector<McidBBoxes> page_boxes;
+  std::vector<PageTagging> page_taggings;
+  std::vector<RewriteJob> jobs;  // strings keep their capacity from batch to batch
+  std::set<QPDFObjGen> seen;     // streams already given a job
+
+  // Pages in later batches scan a shared stream as it was, not as rewritten for an earlier page.
+  std::map<QPDFObjGen, size_t> readers;                     // reads still to come, per stream
+  std::map<QPDFObjGen, std::shared_ptr<Buffer>> originals;  // rewritten streams with readers left
+  for (size_t i = 0; rewrite == Rewrite::Untagged && i < pages.size(); ++i) {
+    for (auto& stream : pages[i].getPageContents()) ++readers[stream.getObjGen()];
+  }
+
+  for (size_t begin = 0; begin < pages.size(); begin += batch_size) {
+    size_t end = std::min(pages.size(), begin + batch_size);
+    size_t job_count = 0;
+
+    // 1. gather content and resources (serial: QPDF is not thread-safe)
+    qpdf_ruby::timed(timings, "read", [&] {
+      snapshots.clear();
+      for (size_t i = begin; i < end; ++i) {
+        qpdf_ruby::check_interrupts();
+        std::vector<QPDFObjectHandle> streams = pages[i].getPageContents();
+        snapshots.push_back(snapshot_page(pages[i], streams, *form_cache));
+
+        for (size_t k = 0; rewrite == Rewrite::Untagged && k < streams.size(); ++k) {
+          QPDFObjGen og = streams[k].getObjGen();
+          bool last = --readers[og] == 0;
+          auto original = originals.find(og);
+          if (original == originals.end()) continue;
+          snapshots.back().contents[k] = original->second;
+          if (last) originals.erase(original);
+        }
+
+        for (size_t k = 0; rewrite != Rewrite::None && k < streams.size(); ++k) {
+          if (!seen.insert(streams[k].getObjGen()).second) continue;  // rewritten for an earlier page
+          if (jobs.size() <= job_count) jobs.emplace_back();
+          RewriteJob& job = jobs[job_count++];
+          job.stream = streams[k];
+          job.page = i - begin;
+          job.content = k;
+          job.changed = false;
+        }
+      }
+    });
+
+    // 2. scan, rewriting streams along the way (parallel: snapshots only)
+    qpdf_ruby::timed(timings, "scan", [&] {
+      page_maps.assign(snapshots.size(), {});
+      page_boxes.assign(snapshots.size(), {});
+      page_taggings.assign(snapshots.size(), {});
+      qpdf_ruby::parallel_for(snapshots.size(), threads, [&](size_t i) {
+        PageSnapshot const& snapshot = snapshots[i];
+        CMDoExtractor cb(snapshot);
+        std::vector<RewriteJob*> owned(snapshot.contents.size(), nullptr);
+        for (size_t j = 0; j < job_count; ++j) {
+          if (jobs[j].page == i) owned[jobs[j].content] = &jobs[j];
+        }
+        if (rewrite != Rewrite::Paths) {
+          cb.scan();
+        } else {
+          // Streams rewritten for another page are still matched, so the boxes agree with the rewrite.
+          for (size_t k = 0; k < snapshot.contents.size(); ++k) {
+            std::string_view in = CMDoExtractor::content_view(*snapshot.contents[k]);
+            PDFArtifactMarker::PathRewriter rewriter(in, owned[k] ? &owned[k]->rewritten : nullptr);
+            cb.scan(in, [&](PDFContentLexer::Token const& token) { return rewriter.feed(token); });
+            bool changed = rewriter.finish();
+            if (owned[k]) owned[k]->changed = changed;
+          }
+        }
+        page_maps[i] = cb.getImageMap();
+        page_boxes[i] = cb.getMcidBBoxes();
+        page_taggings[i] = cb.takeTagging();
+
+        // The spans are known once the page is scanned; each stream is wrapped from its own bytes
+        for (size_t k = 0; rewrite == Rewrite::Untagged && k < snapshot.contents.size(); ++k) {
+          if (!owned[k]) continue;
+          std::vector<std::pair<size_t, size_t>> spans;
+          for (auto const& span : page_taggings[i].untagged) {
+            if (span.wrappable() && span.first_stream == k) spans.emplace_back(span.begin, span.end);
+          }
+          std::string_view in = CMDoExtractor::content_view(*snapshot.contents[k]);
+          owned[k]->changed = PDFArtifactMarker::wrapSpans(in, spans, owned[k]->rewritten);
+        }
+      });
+    });
+
+    // 3. compress (parallel) and install (serial) the rewritten streams
+    if (rewrite != Rewrite::None) {
+      qpdf_ruby::timed(timings, "compress", [&] {
+        qpdf_ruby::parallel_for(job_count, threads, [&](size_t j) {
+          if (jobs[j].changed) marker->encode(jobs[j].rewritten, jobs[j].encoded);
+        });
+      });
+      qpdf_ruby::timed(timings, "install", [&] {
+        for (size_t j = 0; j < job_count; ++j) {
+          if (jobs[j].changed) {
+            QPDFObjGen og = jobs[j].stream.getObjGen();
+            if (rewrite == Rewrite::Untagged && readers[og] > 0) {
+              originals[og] = snapshots[jobs[j].page].contents[jobs[j].content];
+            }
+            marker->install(jobs[j].stream, jobs[j].rewritten, jobs[j].encoded);
+          }
+          jobs[j].stream = QPDFObjectHandle();
+        }
+      });
+    }
+
+    // 4. merge in page order, so the first page drawing an image name wins as before
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+      image_to_mcid.insert(page_maps[i].begin(), page_maps[i].end());
+      page_mcid_bboxes[pages[begin + i].getObjectHandle().getObjGen()] = std::move(page_boxes[i]);
+      page_tagging[pages[begin + i].getObjectHandle().getObjGen()] = std::move(page_taggings[i]);
+    }
+  }
 }
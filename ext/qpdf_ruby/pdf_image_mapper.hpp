@@ -15,14 +15,22 @@
 #include <qpdf/QPDFTokenizer.hh>
 #include <qpdf/Buffer.hh>
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <map>
+#include <optional>
+#include <set>
 #include <stack>
-#include <regex>
 #include <sstream>
-#include <deque>
+
+class PDFArtifactMarker;
+
+namespace qpdf_ruby {
+class PhaseTimings;
+}
 
 struct ImageInfo {
   int mcid;
@@ -49,20 +57,84 @@ struct ImageInfo {
 
 class PDFImageMapper {
  public:
-  explicit PDFImageMapper(int target_mcid);
+  /** MCID -> union of everything painted under it on one page, [llx, lly, urx, ury] clipped to the MediaBox. */
+  using McidBBoxes = std::map<int, std::array<double, 4>>;
+  /** Painted area of each Form XObject in form space (nullopt: paints nothing), by object id. */
+  using FormBBoxCache = std::map<QPDFObjGen, std::optional<std::array<double, 4>>>;
+
+  /**
+   * A graphics object painted outside of both MCID-carrying marked content
+   * and /Artifact. It is bytes [begin, end) of the page's content streams,
+   * counted from `first_stream` and `last_stream`. The two only differ
+   * when the object straddles two streams. Offsets refer to the content
+   * as scanned.
+   */
+  struct UntaggedSpan {
+    enum Kind : uint8_t { Path, Text, Image, InlineImage, Shading, Form };
+
+    Kind kind;
+    size_t first_stream;
+    size_t begin;
+    size_t last_stream;
+    size_t end;
+    std::array<double, 4> bbox;  // user space, clipped
+
+    /** Whether it can be wrapped in /Artifact BMC … EMC as is; forms may hold tagged content of their own. */
+    bool wrappable() const { return kind != Form && first_stream == last_stream; }
+  };
 
+  /** What one page's content says about tagging. */
+  struct PageTagging {
+    std::vector<int> mcids;              // every MCID a BDC opens, sorted, without repeats
+    std::vector<UntaggedSpan> untagged;  // in content order
+  };
+
+  /**
+   * `threads` > 1 scans the content streams of a batch of pages concurrently.
+   * Pass a `form_cache` that outlives the mapper to share measured forms
+   * between scans of the same document.
+   */
+  explicit PDFImageMapper(int target_mcid, unsigned threads = 1, FormBBoxCache* form_cache = nullptr);
+
+  // Scans every page; results are merged in page order whatever `threads` is
   void find(QPDF& pdf);
+  // Same, limited to the given page objects
+  void find(QPDF& pdf, const std::set<QPDFObjGen>& only_pages, qpdf_ruby::PhaseTimings* timings = nullptr);
+  /**
+   * Scans every page like find(pdf) and marks rectangle paths as artifacts
+   * with `marker` in the same pass: each content stream is decoded and lexed
+   * once, its tokens feeding both the rewrite and the scan. Boxes come out
+   * as for the rewritten document, i.e. the marked paths count as artifacts.
+   */
+  void findAndMarkPaths(QPDF& pdf, PDFArtifactMarker const& marker, qpdf_ruby::PhaseTimings* timings = nullptr);
+  /**
+   * Scans every page like find(pdf) and wraps each wrappable untagged span
+   * in /Artifact BMC … EMC, compressed and installed as `marker` would.
+   * getPageTagging() describes the content as it was before.
+   */
+  void findAndMarkUntagged(QPDF& pdf, PDFArtifactMarker const& marker, qpdf_ruby::PhaseTimings* timings = nullptr);
   // Parses the page's content stream to find the XObject name for the MCID
   void find(QPDFPageObjectHelper& page);
 
-  void push_cm(double value);
-
   // Expose internal map for external use
   const std::map<std::string, ImageInfo>& getImageMap() const { return image_to_mcid; }
+  // Per scanned page (including pages without marked content)
+  const std::map<QPDFObjGen, McidBBoxes>& getPageMcidBBoxes() const { return page_mcid_bboxes; }
+  // Per scanned page, like getPageMcidBBoxes()
+  const std::map<QPDFObjGen, PageTagging>& getPageTagging() const { return page_tagging; }
 
  private:
+  // What scan() writes back into the content streams, using `marker`'s settings
+  enum class Rewrite { None, Paths, Untagged };
+
+  void scan(std::vector<QPDFPageObjectHelper>& pages, Rewrite rewrite, PDFArtifactMarker const* marker,
+            qpdf_ruby::PhaseTimings* timings);
+
   int target_mcid;
-  bool in_target_mcid;
+  unsigned threads;
   std::map<std::string, ImageInfo> image_to_mcid;
-  std::deque<double> cm_fixed_size_queue;
+  std::map<QPDFObjGen, McidBBoxes> page_mcid_bboxes;
+  std::map<QPDFObjGen, PageTagging> page_tagging;
+  FormBBoxCache own_form_cache;
+  FormBBoxCache* form_cache;
 };
\ No newline at end of file
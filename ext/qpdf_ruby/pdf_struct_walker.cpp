@@ -1,35 +1,76 @@
 #include "pdf_struct_walker.hpp"
-#include "struct_node.hpp"
 
-PDFStructWalker::PDFStructWalker(std::ostream& out, const std::unordered_map<int, std::array<double, 4>>& mcid2bbox)
-    : out(out), mcid2bbox(const_cast<std::unordered_map<int, std::array<double, 4>>&>(mcid2bbox)) {}
+PDFStructWalker::PDFStructWalker(const McidIndex* mcidIndex) : mcidIndex(mcidIndex) {}
 
-std::string PDFStructWalker::get_structure_as_string(QPDFObjectHandle const& node) {
-  std::unique_ptr<StructNode> structNode = StructNode::fromQPDF(node);
+bool PDFStructWalker::addLayoutBBox(QPDFObjectHandle figure, QPDFObjectHandle const& page,
+                                    std::optional<std::array<double, 4>> const& box) {
+  if (!page.isIndirect()) return false;
 
-  return structNode->to_string(0, *this);
-}
-
-void PDFStructWalker::ensureLayoutBBox(QPDFObjectHandle const& node) {
-  std::unique_ptr<StructNode> structNode = StructNode::fromQPDF(node);
+  QPDFObjectHandle arr = QPDFObjectHandle::newArray();
+  for (double v : box ? *box : getPageCropBoxFor(page)) {
+    arr.appendItem(QPDFObjectHandle::newReal(v));
+  }
 
-  structNode->ensureLayoutBBox(*this);
+  QPDFObjectHandle attrs = QPDFObjectHandle::newDictionary();
+  attrs.replaceKey("/O", QPDFObjectHandle::newName("/Layout"));
+  attrs.replaceKey("/BBox", arr);
+  figure.replaceKey("/A", attrs);
+  return true;
 }
 
 void PDFStructWalker::buildPageObjectMap(QPDF& pdf) {
   pageObjToNumMap.clear();
   std::vector<QPDFObjectHandle> pages = pdf.getAllPages();
+  pageObjToNumMap.reserve(pages.size());
   for (int i = 0; i < pages.size(); ++i) {
     // Map the page's object ID to its 1-based page number
     pageObjToNumMap[pages.at(i).getObjGen()] = i + 1;
   }
 }
 
-const std::map<QPDFObjGen, int>& PDFStructWalker::getPageObjectMap() const { return pageObjToNumMap; }
+std::optional<std::array<double, 4>> PDFStructWalker::findMcidBBox(QPDFObjectHandle const& page, int mcid) const {
+  if (!mcidIndex) return std::nullopt;
+  return mcidIndex->find(page.getObjGen(), mcid);
+}
+
+int PDFStructWalker::getPageNumber(QPDFObjectHandle const& page) const {
+  if (!page.isIndirect()) return -1;
+  auto it = pageObjToNumMap.find(page.getObjGen());
+  return it == pageObjToNumMap.end() ? -1 : it->second;
+}
+
+QPDFObjectHandle PDFStructWalker::findInheritedPage(QPDFObjectHandle const& elem) {
+  std::vector<QPDFObjGen> unresolved;  // elements on the way up that share the answer
+  QPDFObjectHandle page = QPDFObjectHandle::newNull();
+  QPDFObjectHandle current = elem;
+
+  while (current.isDictionary()) {
+    if (current.isIndirect()) {
+      // The placeholder also stops the walk should a broken /P chain loop back on itself
+      auto [cached, inserted] = inheritedPages.emplace(current.getObjGen(), QPDFObjectHandle::newNull());
+      if (!inserted) {
+        page = cached->second;
+        break;
+      }
+      unresolved.push_back(current.getObjGen());
+    }
+
+    QPDFObjectHandle pg = current.getKey("/Pg");
+    if (pg.isIndirect()) {
+      page = pg;
+      break;
+    }
+    current = current.getKey("/P");
+  }
+
+  for (auto const& og : unresolved) inheritedPages[og] = page;
+  return page;
+}
 
 std::array<double, 4> PDFStructWalker::getPageCropBoxFor(QPDFObjectHandle const& page_oh) const {
   auto inherited = [](QPDFObjectHandle node, char const* key) -> QPDFObjectHandle {
-    while (!node.isNull()) {
+    std::unordered_set<QPDFObjGen, ObjGenHash> seen;  // a looping /Parent chain ends the search
+    while (node.isDictionary() && (!node.isIndirect() || seen.insert(node.getObjGen()).second)) {
       if (auto val = node.getKey(key); !val.isNull()) return val;
       node = node.getKey("/Parent");
     }
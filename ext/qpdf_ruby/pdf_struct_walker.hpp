@@ -9,28 +9,48 @@
 #include <qpdf/QPDFPageObjectHelper.hh>
 #include <qpdf/QPDFObjectHandle.hh>
 
-#include <iostream>
+#include "mcid_index.hpp"
+
 #include <stdexcept>  // For std::exception (if you add try-catch)
 #include <vector>     // For std::vector
 #include <string>     // For std::string
 #include <regex>
 #include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+struct ObjGenHash {
+  size_t operator()(QPDFObjGen const& og) const {
+    return std::hash<long long>()((static_cast<long long>(og.getObj()) << 16) ^ og.getGen());
+  }
+};
 
 class PDFStructWalker {
  private:
-  std::ostream& out;
-  std::map<QPDFObjGen, int> pageObjToNumMap;
-  std::unordered_map<int, std::array<double, 4>>& mcid2bbox;
+  std::unordered_map<QPDFObjGen, int, ObjGenHash> pageObjToNumMap;
+  // Page each element visited so far is on; null when neither it nor an ancestor has a /Pg
+  std::unordered_map<QPDFObjGen, QPDFObjectHandle, ObjGenHash> inheritedPages;
+  const McidIndex* mcidIndex;
 
  public:
-  PDFStructWalker(std::ostream& out = std::cout, const std::unordered_map<int, std::array<double, 4>>& mcid2bbox = {});
+  explicit PDFStructWalker(const McidIndex* mcidIndex = nullptr);
 
   void buildPageObjectMap(QPDF& pdf);
-  std::string get_structure_as_string(QPDFObjectHandle const& node);
-  void ensureLayoutBBox(QPDFObjectHandle const& node);
 
-  const std::map<QPDFObjGen, int>& getPageObjectMap() const;
+  // Replaces /A of `figure` with a layout BBox: `box` if known, else the crop box of `page`.
+  // Returns false (and leaves the Figure alone) if `page` is not a page object.
+  bool addLayoutBBox(QPDFObjectHandle figure, QPDFObjectHandle const& page,
+                     std::optional<std::array<double, 4>> const& box);
+
+  // 1-based number of `page`, or -1 if it isn't one of the document's pages
+  int getPageNumber(QPDFObjectHandle const& page) const;
+  // The /Pg of `elem` or of its nearest ancestor along /P. The traversal visits parents first, so
+  // this is normally one lookup in the cache; every element resolved on the way up is cached too.
+  QPDFObjectHandle findInheritedPage(QPDFObjectHandle const& elem);
   std::array<double, 4> getPageCropBoxFor(QPDFObjectHandle const& elem) const;
 
-  const std::unordered_map<int, std::array<double, 4>>& getMcidBboxMap() const { return mcid2bbox; }
+  // Area covered by `mcid` on `page` according to the index, if known
+  std::optional<std::array<double, 4>> findMcidBBox(QPDFObjectHandle const& page, int mcid) const;
 };
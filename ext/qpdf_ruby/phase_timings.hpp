@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace qpdf_ruby {
+
+/**
+ * Wall-clock seconds spent per named phase of a job, in the order the
+ * phases first ran. A phase that runs several times (once per batch of
+ * pages, say) adds up.
+ */
+class PhaseTimings {
+ public:
+  template <typename Fn>
+  void measure(char const* phase, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    add(phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  void add(char const* phase, double seconds) {
+    for (auto& entry : entries) {
+      if (entry.first == phase) {
+        entry.second += seconds;
+        return;
+      }
+    }
+    entries.emplace_back(phase, seconds);
+  }
+
+  std::vector<std::pair<std::string, double>> const& phases() const { return entries; }
+
+ private:
+  std::vector<std::pair<std::string, double>> entries;
+};
+
+/** Runs `fn`, timed as `phase` when `timings` is given. */
+template <typename Fn>
+void timed(PhaseTimings* timings, char const* phase, Fn&& fn) {
+  if (timings) {
+    timings->measure(phase, fn);
+  } else {
+    fn();
+  }
+}
+
+}  // namespace qpdf_ruby
@@ -1,19 +1,28 @@
 #include "qpdf_ruby.hpp"
+#include "accessibility_lint.hpp"
 #include "pdf_struct_walker.hpp"
-#include "struct_node.hpp"
+#include "structure_model.hpp"
+#include "structure_export.hpp"
 #include "pdf_image_mapper.hpp"
+#include "pdf_artifact_marker.hpp"
+#include "parent_tree_index.hpp"
 #include "document_handle.hpp"
+#include "without_gvl.hpp"
+#include "parallel.hpp"
+#include "ruby_pipeline.hpp"
+#include "phase_timings.hpp"
+#include "xml_writer.hpp"
 
 #include <qpdf/QPDF.hh>
 #include <qpdf/QPDFWriter.hh>
 #include <qpdf/QPDFPageObjectHelper.hh>
 #include <qpdf/QPDFObjectHandle.hh>
 
-#include <iostream>
+#include <algorithm>
 #include <stdexcept>  // For std::exception (if you add try-catch)
+#include <unordered_map>
 #include <vector>     // For std::vector
 #include <string>     // For std::string
-#include <regex>
 
 VALUE rb_mQpdfRuby;
 VALUE rb_cDocument;
@@ -21,129 +30,699 @@ VALUE rb_eQpdfRubyError;
 
 using namespace qpdf_ruby;
 
-VALUE rb_qpdf_get_structure_string(VALUE self) {
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
+/** Payload of a QpdfRuby::Document: the native handle plus the Ruby objects it borrows from. */
+struct RubyDocument {
+  DocumentHandle* handle = nullptr;
+  VALUE source = Qnil;  // frozen String QPDF reads in place (Document.from_memory)
+};
+
+static DocumentHandle* get_handle(VALUE self) {
+  RubyDocument* doc;
+  Data_Get_Struct(self, RubyDocument, doc);
+  if (!doc->handle) rb_raise(rb_eQpdfRubyError, "Document is not initialized");
+  return doc->handle;
+}
+
+// Claims the busy flag of `h`, so one native call at a time works on a document.
+static void acquire(DocumentHandle* h) {
+  if (!h->try_acquire()) rb_raise(rb_eQpdfRubyError, "Document is in use by another thread");
+}
 
+/**
+ * Runs the QPDF heavy part of a Document method without the GVL.
+ *
+ * Ruby objects must be read before and converted after this call; `fn`
+ * itself only sees plain C++ data. C++ failures become `error_class`,
+ * Thread#raise/Timeout while running surface as the pending Ruby interrupt.
+ */
+template <typename Fn>
+static void run_without_gvl(DocumentHandle* h, VALUE error_class, Fn&& fn) {
+  if (h) acquire(h);
+
+  VALUE exc = Qnil;
+  bool interrupted = false;
+  int ruby_state = 0;
   try {
-    QPDF& pdf = h->qpdf();
+    qpdf_ruby::call_without_gvl(fn);
+  } catch (const qpdf_ruby::Interrupted&) {
+    interrupted = true;
+  } catch (const qpdf_ruby::RubyError& e) {
+    ruby_state = e.state();
+  } catch (const StructureLimitExceeded& e) {
+    exc = rb_exc_new_cstr(rb_eQpdfRubyError, e.what());
+  } catch (const QPDFExc& e) {
+    exc = rb_exc_new_str(error_class, rb_sprintf("QPDF Error: %s (filename: %s)", e.what(), e.getFilename().c_str()));
+  } catch (const std::exception& e) {
+    exc = rb_exc_new_cstr(error_class, e.what());
+  }
+  if (h) h->release();
 
-    QPDFObjectHandle catalog = pdf.getRoot();
-    QPDFObjectHandle struct_root = catalog.getKey("/StructTreeRoot");
-    if (!struct_root.isDictionary()) {
-      rb_raise(rb_eRuntimeError, "No StructTreeRoot found");
-    }
-    QPDFObjectHandle topKids = struct_root.getKey("/K");
+  if (ruby_state) rb_jump_tag(ruby_state);  // re-raise what a Ruby callback (IO#write, a block) raised
+  if (interrupted) {
+    rb_thread_check_ints();  // raises whatever Thread#raise / Timeout queued
+    exc = rb_exc_new_cstr(rb_eQpdfRubyError, "interrupted");
+  }
+  if (!NIL_P(exc)) rb_exc_raise(exc);
+}
 
-    PDFStructWalker walker(std::cout);  // For now, std::cout, unless you pass another stream
-    walker.buildPageObjectMap(pdf);
+/**
+ * Changes settings of `h` with the GVL held. The busy flag keeps a
+ * run_without_gvl() call on another thread from reading them meanwhile;
+ * convert every Ruby argument before, as `fn` must not call into Ruby.
+ */
+template <typename Fn>
+static void update_handle(DocumentHandle* h, Fn&& fn) {
+  acquire(h);
+  VALUE exc = Qnil;
+  try {
+    fn();
+  } catch (const std::exception& e) {
+    exc = rb_exc_new_cstr(rb_eQpdfRubyError, e.what());
+  }
+  h->release();
+  if (!NIL_P(exc)) rb_exc_raise(exc);
+}
 
-    std::string result;
-    if (topKids.isArray()) {
-      for (int i = 0; i < topKids.getArrayNItems(); ++i) {
-        result += walker.get_structure_as_string(topKids.getArrayItem(i));
-      }
-    } else {
-      result = walker.get_structure_as_string(topKids);
-    }
+// Writes the structure tree as XML into `sink`, one node at a time.
+static void write_structure(DocumentHandle* h, Pipeline& sink) {
+  XmlWriter out(sink);
+  h->structure().writeXml(out);
+  out.finish();
+}
 
-    return rb_str_new(result.c_str(), result.length());
-  } catch (const std::exception& e) {
-    rb_raise(rb_eRuntimeError, "Error: %s", e.what());
+/**
+ * call-seq:
+ *   show_structure -> String
+ *   show_structure(io, chunk_size: 65536) -> Integer
+ *   show_structure(chunk_size: 65536) { |chunk| ... } -> Integer
+ *
+ * The structure tree as XML. Given an IO (anything responding to #write)
+ * or a block, the XML is handed over in chunks of `chunk_size` bytes while
+ * it is produced, and the number of bytes is returned.
+ */
+VALUE rb_qpdf_get_structure_string(int argc, VALUE* argv, VALUE self) {
+  VALUE io, kwargs, block;
+  rb_scan_args(argc, argv, "01:&", &io, &kwargs, &block);
+
+  ID keys[1] = {rb_intern("chunk_size")};
+  VALUE values[1] = {Qundef};
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 1, values);
+  size_t chunk_size = values[0] == Qundef ? qpdf_ruby::RubyIOPipeline::DEFAULT_CHUNK_SIZE : NUM2SIZET(values[0]);
+  if (chunk_size == 0) rb_raise(rb_eArgError, "chunk_size must be positive");
+  if (!NIL_P(io) && !NIL_P(block)) rb_raise(rb_eArgError, "pass either an IO or a block, not both");
+
+  DocumentHandle* h = get_handle(self);
+
+  if (NIL_P(io) && NIL_P(block)) {
+    qpdf_ruby::RubyStringPipeline out(64 * 1024);
+    run_without_gvl(h, rb_eRuntimeError, [&] { write_structure(h, out); });
+    VALUE result = out.result();
+    rb_enc_associate(result, rb_utf8_encoding());
+    return result;
   }
-  return Qnil;
+
+  VALUE target = NIL_P(io) ? block : io;
+  qpdf_ruby::RubyIOPipeline out(target, rb_intern(NIL_P(io) ? "call" : "write"), chunk_size);
+  run_without_gvl(h, rb_eRuntimeError, [&] { write_structure(h, out); });
+  RB_GC_GUARD(target);
+
+  return SIZET2NUM(out.bytes_written());
 }
 
-VALUE rb_qpdf_mark_paths_as_artifacts(VALUE self) {
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
-  try {
-    QPDF& pdf = h->qpdf();
+static VALUE build_tree(VALUE builder) { return reinterpret_cast<StructureRubyBuilder*>(builder)->tree(); }
+
+/**
+ * call-seq: structure_tree(format: :hash) -> Array or String
+ *
+ * The structure tree without an XML round-trip. `:hash` returns an Array
+ * of nested Hashes with Symbol keys and tags, `:json` and `:msgpack` the
+ * same tree serialized into a single String.
+ */
+VALUE rb_qpdf_structure_tree(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[1] = {rb_intern("format")};
+  VALUE values[1] = {Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 1, values);
+
+  ID format = values[0] == Qundef ? rb_intern("hash") : rb_sym2id(values[0]);
+  bool json = format == rb_intern("json");
+  bool msgpack = format == rb_intern("msgpack");
+  if (!json && !msgpack && format != rb_intern("hash")) {
+    rb_raise(rb_eArgError, "format must be :hash, :json or :msgpack");
+  }
+
+  DocumentHandle* h = get_handle(self);
+  std::shared_ptr<const StructureModel> structure;
+  std::string out;
+
+  run_without_gvl(h, rb_eRuntimeError, [&] {
+    structure = h->shared_structure();
+    if (json) structure_to_json(*structure, out);
+    if (msgpack) structure_to_msgpack(*structure, out);
+  });
+
+  if (json) return rb_utf8_str_new(out.data(), static_cast<long>(out.size()));
+  if (msgpack) return rb_str_new(out.data(), static_cast<long>(out.size()));
+
+  // Needs the GVL; another thread may edit the structure meanwhile, so `structure` keeps this snapshot alive.
+  // rb_protect, so a Ruby exception unwinds the builder and `structure` before it propagates.
+  VALUE tree = Qnil;
+  int state = 0;
+  {
+    StructureRubyBuilder builder(*structure);
+    tree = rb_protect(build_tree, reinterpret_cast<VALUE>(&builder), &state);
+  }
+  structure.reset();
+  if (state != 0) rb_jump_tag(state);
+
+  return tree;
+}
+
+// What rb_protect hands to yield_element(): the node to build a Hash for, and the builder to use
+struct ElementToYield {
+  StructureRubyBuilder* builder;
+  uint32_t index;
+};
+
+static VALUE yield_element(VALUE arg) {
+  auto* element = reinterpret_cast<ElementToYield*>(arg);
+  return rb_yield(element->builder->node(element->index));
+}
+
+/**
+ * call-seq: each_struct_element(tag: nil, page: nil) { |element| … } -> self
+ *           each_struct_element(tag: nil, page: nil) -> Enumerator
+ *
+ * Yields the structure elements with tag `tag` (String or Symbol) on
+ * `page` (1-based), in document order, as Hashes shaped like those of
+ * structure_tree but without `kids`. Filtering happens natively, so only
+ * matching elements become Ruby objects, and `break` (or Enumerator#first)
+ * ends the walk early. The walk runs over a snapshot of the parsed tree,
+ * so the block may call ensure_bbox and alike.
+ */
+VALUE rb_qpdf_each_struct_element(int argc, VALUE* argv, VALUE self) {
+  RETURN_ENUMERATOR_KW(self, argc, argv, RB_PASS_CALLED_KEYWORDS);
 
-    std::vector<QPDFObjectHandle> pages = pdf.getAllPages();
-    std::regex path_regex(R"((?:[-+]?\d*\.?\d+(?:e[-+]?\d+)?\s+){4}re\s+(?:S|s|f\*?|F|B\*?|b\*?|n))",
-                          std::regex::ECMAScript | std::regex::optimize);
+  VALUE kwargs;
+  ID keys[2] = {rb_intern("tag"), rb_intern("page")};
+  VALUE values[2] = {Qundef, Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 2, values);
+
+  bool by_tag = values[0] != Qundef && !NIL_P(values[0]);
+  VALUE tag_str = Qnil;
+  if (by_tag) {
+    tag_str = SYMBOL_P(values[0]) ? rb_sym2str(values[0]) : values[0];
+    StringValue(tag_str);
+  }
+  bool by_page = values[1] != Qundef && !NIL_P(values[1]);
+  int page = by_page ? NUM2INT(values[1]) : 0;
+
+  DocumentHandle* h = get_handle(self);
+
+  // Every C++ local lives in this block, so none is skipped by rb_jump_tag() below
+  int state = 0;
+  {
+    std::shared_ptr<const StructureModel> structure;
+    run_without_gvl(h, rb_eRuntimeError, [&] { structure = h->shared_structure(); });
+
+    using Kind = StructureModel::Kind;
+    std::string tag = by_tag ? std::string(RSTRING_PTR(tag_str), RSTRING_LEN(tag_str)) : std::string();
+    StructureRubyBuilder builder(*structure);
+    std::vector<uint32_t> stack;
+    for (uint32_t i = structure->rootCount(); i-- > 0;) stack.push_back(i);
+
+    while (!stack.empty() && state == 0) {
+      uint32_t index = stack.back();
+      stack.pop_back();
+      StructureModel::Node const& node = structure->node(index);
+      if (node.kind != Kind::Element) continue;
+
+      for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) stack.push_back(i);
+
+      if (by_tag && structure->text(node.name) != tag) continue;
+      if (by_page && node.page != page) continue;
+
+      // rb_protect around building and yielding the Hash, so a break or an exception (in the block or
+      // while allocating) unwinds the C++ locals before it propagates
+      ElementToYield element{&builder, index};
+      rb_protect(yield_element, reinterpret_cast<VALUE>(&element), &state);
+    }
+  }
+  if (state != 0) rb_jump_tag(state);
+
+  return self;
+}
 
-    for (auto& page_obj : pages) {
-      QPDFPageObjectHelper poh(page_obj);
-      std::vector<QPDFObjectHandle> contents = poh.getPageContents();
-      std::vector<QPDFObjectHandle> new_contents_array;
+// Value of a `threads:` keyword argument (Qundef when not given), capped at max_threads().
+static unsigned threads_option(VALUE value) {
+  int threads = value == Qundef ? 1 : NUM2INT(value);
+  if (threads < 1) rb_raise(rb_eArgError, "threads must be at least 1");
+  return std::min(static_cast<unsigned>(threads), max_threads());
+}
 
-      for (auto& content_stream : contents) {
-        if (content_stream.isStream()) {
-          // Use std::shared_ptr instead of PointerHolder
-          std::shared_ptr<Buffer> stream_buffer = content_stream.getStreamData();
-          std::string stream_data_str(reinterpret_cast<char*>(stream_buffer->getBuffer()), stream_buffer->getSize());
+// Value of a `compression_level:` keyword argument (Qundef when not given).
+static int compression_level_option(VALUE value) {
+  int level = value == Qundef ? PDFArtifactMarker::DEFAULT_COMPRESSION_LEVEL : NUM2INT(value);
+  if (level < 0 || level > 9) rb_raise(rb_eArgError, "compression_level must be between 0 and 9");
+  return level;
+}
 
-          std::string new_stream_data_str = std::regex_replace(stream_data_str, path_regex, "/Artifact BMC\n$&\nEMC");
+// Adds a layout BBox to every Figure missing one, scanning only the pages that hold such Figures.
+static void ensure_figure_bboxes(DocumentHandle* h, unsigned threads, PhaseTimings* timings) {
+  QPDF& pdf = h->qpdf();
 
-          // Create a new Buffer with std::shared_ptr
-          std::shared_ptr<Buffer> new_buffer = std::make_shared<Buffer>(new_stream_data_str.length());
-          memcpy(new_buffer->getBuffer(), new_stream_data_str.data(), new_stream_data_str.length());
+  const StructureModel* structure = nullptr;
+  timed(timings, "structure", [&] { structure = &h->structure(); });
+
+  // Only pages holding a Figure without a BBox are worth scanning.
+  size_t missing = 0;
+  std::set<QPDFObjGen> pages;
+  for (auto const& figure : structure->figures()) {
+    if (figure.has_layout_bbox) continue;
+    ++missing;
+    if (figure.page.isIndirect()) pages.insert(figure.page.getObjGen());
+  }
+  if (missing == 0) return;
 
-          QPDFObjectHandle new_stream = QPDFObjectHandle::newStream(&pdf, new_buffer);
-          new_contents_array.push_back(new_stream);
-        } else {
-          new_contents_array.push_back(content_stream);
-        }
+  McidIndex& index = h->mcid_index();
+  index.indexPages(pdf, pages, threads, timings);
+
+  PDFStructWalker walker(&index);
+
+  timed(timings, "structure", [&] {
+    // A Figure's box covers every MCID the ParentTree gives to it, on the pages scanned
+    auto const& figures = structure->figures();
+    std::unordered_map<QPDFObjGen, size_t, ObjGenHash> missing_at;
+    for (size_t i = 0; i < figures.size(); ++i) {
+      if (!figures[i].has_layout_bbox && figures[i].element.isIndirect()) {
+        missing_at.emplace(figures[i].element.getObjGen(), i);
       }
+    }
+
+    std::vector<std::optional<McidIndex::BBox>> boxes(figures.size());
+    auto grow = [](std::optional<McidIndex::BBox>& box, std::optional<McidIndex::BBox> const& b) {
+      if (!b) return;
+      box = box ? McidIndex::BBox{std::min((*box)[0], (*b)[0]), std::min((*box)[1], (*b)[1]),
+                                  std::max((*box)[2], (*b)[2]), std::max((*box)[3], (*b)[3])}
+                : *b;
+    };
+
+    ParentTreeIndex const& parents = h->parent_tree();
+    for (QPDFObjGen const& page : pages) {
+      parents.forEach(page, [&](int mcid, QPDFObjectHandle const& element) {
+        if (!element.isIndirect()) return;
+        auto it = missing_at.find(element.getObjGen());
+        if (it != missing_at.end()) grow(boxes[it->second], index.find(page, mcid));
+      });
+    }
 
-      if (new_contents_array.size() == 1) {
-        page_obj.replaceKey("/Contents", new_contents_array[0]);
-      } else {
-        page_obj.replaceKey("/Contents", QPDFObjectHandle::newArray(new_contents_array));
+    for (size_t i = 0; i < figures.size(); ++i) {
+      auto const& figure = figures[i];
+      if (figure.has_layout_bbox) continue;
+      // Without ParentTree entries, fall back to the MCIDs in the Figure's own /K, then to the crop box
+      if (!boxes[i]) {
+        for (int mcid : figure.mcids) grow(boxes[i], walker.findMcidBBox(figure.page, mcid));
       }
+      walker.addLayoutBBox(figure.element, figure.page, boxes[i]);
+    }
+  });
+  h->structure_changed();
+}
+
+/**
+ * call-seq: mark_paths_as_artifacts(threads: 1, compression_level: 6) -> nil
+ *
+ * With `threads:` > 1 the content streams of several pages are rewritten
+ * concurrently; reading and installing streams stays on one thread.
+ * Rewritten streams are Flate compressed at `compression_level:`; 0 skips
+ * that step and leaves them to QPDFWriter, which still compresses them on
+ * write by default.
+ */
+VALUE rb_qpdf_mark_paths_as_artifacts(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[2] = {rb_intern("threads"), rb_intern("compression_level")};
+  VALUE values[2] = {Qundef, Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 2, values);
+
+  unsigned threads = threads_option(values[0]);
+  int level = compression_level_option(values[1]);
+
+  DocumentHandle* h = get_handle(self);
+
+  run_without_gvl(h, rb_eRuntimeError, [&] {
+    PDFArtifactMarker marker(threads, level);
+    marker.markPaths(h->qpdf());
+    h->content_changed();
+  });
+
+  return Qnil;
+}
+
+/**
+ * call-seq: ensure_bbox(threads: 1) -> nil
+ *
+ * With `threads:` > 1 the content streams of several pages are scanned
+ * for images concurrently.
+ */
+VALUE rb_qpdf_ensure_bboxs(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[1] = {rb_intern("threads")};
+  VALUE values[1] = {Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 1, values);
+
+  unsigned threads = threads_option(values[0]);
+
+  DocumentHandle* h = get_handle(self);
+
+  run_without_gvl(h, rb_eRuntimeError, [&] { ensure_figure_bboxes(h, threads, nullptr); });
+  return Qnil;
+}
+
+/**
+ * call-seq: accessibility_fixup(artifacts: true, bbox: true, threads: 1, compression_level: 6) -> {phase => seconds}
+ *
+ * mark_paths_as_artifacts and ensure_bbox in one go. With both enabled,
+ * each page's content streams are decoded and lexed once: the same tokens
+ * feed the artifact rewrite and the bounding box scan. Returns the wall
+ * time spent per phase (:read, :scan, :compress, :install, :structure).
+ */
+VALUE rb_qpdf_accessibility_fixup(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[4] = {rb_intern("artifacts"), rb_intern("bbox"), rb_intern("threads"), rb_intern("compression_level")};
+  VALUE values[4] = {Qundef, Qundef, Qundef, Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 4, values);
+
+  bool artifacts = values[0] == Qundef || RTEST(values[0]);
+  bool bbox = values[1] == Qundef || RTEST(values[1]);
+  unsigned threads = threads_option(values[2]);
+  int level = compression_level_option(values[3]);
+
+  DocumentHandle* h = get_handle(self);
+  PhaseTimings timings;
+
+  run_without_gvl(h, rb_eRuntimeError, [&] {
+    PDFArtifactMarker marker(threads, level);
+    if (artifacts && bbox) {
+      // The pass indexes the rewritten content, so the fresh index stays valid.
+      h->content_changed();
+      h->mcid_index().markPathsAndIndex(h->qpdf(), marker, threads, &timings);
+    } else if (artifacts) {
+      marker.markPaths(h->qpdf(), &timings);
+      h->content_changed();
     }
-  } catch (const QPDFExc& e) {  // Catching specific QPDF exceptions is good
-    rb_raise(rb_eRuntimeError, "QPDF Error: %s (filename: %s)", e.what(), e.getFilename().c_str());
-  } catch (const std::exception& e) {  // Fallback for other standard exceptions
-    rb_raise(rb_eRuntimeError, "Error: %s", e.what());
+    if (bbox) ensure_figure_bboxes(h, threads, &timings);
+  });
+
+  VALUE result = rb_hash_new();
+  for (auto const& [phase, seconds] : timings.phases()) {
+    rb_hash_aset(result, ID2SYM(rb_intern(phase.c_str())), DBL2NUM(seconds));
   }
+  return result;
+}
+
+/**
+ * call-seq: structure_limits(max_depth: 1000, max_nodes: 5_000_000) -> nil
+ *
+ * Budgets for reading the structure tree. A tree nested deeper than
+ * `max_depth` or holding more than `max_nodes` nodes makes show_structure,
+ * ensure_bbox and friends raise QpdfRuby::Error instead of running on.
+ * Omitted limits keep their current value.
+ */
+VALUE rb_qpdf_structure_limits(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[2] = {rb_intern("max_depth"), rb_intern("max_nodes")};
+  VALUE values[2] = {Qundef, Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 2, values);
 
+  DocumentHandle* h = get_handle(self);
+  StructureModel::Limits limits = h->structure_limits();
+  if (values[0] != Qundef) limits.max_depth = NUM2SIZET(values[0]);
+  if (values[1] != Qundef) limits.max_nodes = NUM2SIZET(values[1]);
+  if (limits.max_depth < 1 || limits.max_nodes < 1) rb_raise(rb_eArgError, "limits must be at least 1");
+
+  // Drops the parsed structure, which a call running without the GVL may be using
+  update_handle(h, [&] { h->set_structure_limits(limits); });
   return Qnil;
 }
 
-VALUE rb_qpdf_ensure_bboxs(VALUE self) {
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
+/**
+ * call-seq: elements_at(page:, rect:) -> [{mcid:, bbox:}, ...]
+ *
+ * Marked content on `page` (1-based) whose area intersects `rect`
+ * ([llx, lly, urx, ury] in default user space; any two opposite corners),
+ * ordered by MCID. Each page is scanned once per document; later queries
+ * only hit the index.
+ */
+VALUE rb_qpdf_elements_at(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[2] = {rb_intern("page"), rb_intern("rect")};
+  VALUE values[2];
 
-  try {
+  rb_scan_args(argc, argv, ":", &kwargs);
+  rb_get_kwargs(kwargs, keys, 2, 0, values);
+
+  long page_number = NUM2LONG(values[0]);
+  VALUE rect_ary = rb_Array(values[1]);
+  if (RARRAY_LEN(rect_ary) != 4) rb_raise(rb_eArgError, "rect must be [llx, lly, urx, ury]");
+
+  McidIndex::BBox rect;
+  for (long i = 0; i < 4; ++i) rect[i] = NUM2DBL(rb_ary_entry(rect_ary, i));
+  rect = {std::min(rect[0], rect[2]), std::min(rect[1], rect[3]), std::max(rect[0], rect[2]),
+          std::max(rect[1], rect[3])};
+
+  DocumentHandle* h = get_handle(self);
+  std::vector<McidIndex::Entry> entries;
+
+  run_without_gvl(h, rb_eRuntimeError, [&] {
     QPDF& pdf = h->qpdf();
+    std::vector<QPDFObjectHandle> const& pages = pdf.getAllPages();
+    if (page_number < 1 || static_cast<size_t>(page_number) > pages.size()) {
+      throw std::runtime_error("page " + std::to_string(page_number) + " out of range (1.." +
+                               std::to_string(pages.size()) + ")");
+    }
+
+    QPDFObjGen page = pages[page_number - 1].getObjGen();
+    McidIndex& index = h->mcid_index();
+    index.indexPages(pdf, {page});
+    entries = index.query(page, rect);
+  });
+
+  VALUE sym_mcid = ID2SYM(rb_intern("mcid"));
+  VALUE sym_bbox = ID2SYM(rb_intern("bbox"));
+  VALUE result = rb_ary_new_capa(static_cast<long>(entries.size()));
+  for (auto const& entry : entries) {
+    VALUE bbox = rb_ary_new_capa(4);
+    for (double v : entry.bbox) rb_ary_push(bbox, DBL2NUM(v));
+
+    VALUE element = rb_hash_new();
+    rb_hash_aset(element, sym_mcid, INT2NUM(entry.mcid));
+    rb_hash_aset(element, sym_bbox, bbox);
+    rb_ary_push(result, element);
+  }
+  return result;
+}
+
+/**
+ * call-seq: struct_element_for(page:, mcid:) -> {tag:, obj:, gen:} or nil
+ *
+ * The structure element that owns marked content `mcid` on `page`
+ * (1-based), as recorded in the ParentTree; nil if there is none. The
+ * ParentTree is decoded once per document, so each call is a lookup.
+ */
+VALUE rb_qpdf_struct_element_for(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[2] = {rb_intern("page"), rb_intern("mcid")};
+  VALUE values[2];
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  rb_get_kwargs(kwargs, keys, 2, 0, values);
+
+  long page_number = NUM2LONG(values[0]);
+  int mcid = NUM2INT(values[1]);
+
+  DocumentHandle* h = get_handle(self);
+  bool found = false;
+  std::string tag;
+  QPDFObjGen og;
 
-    QPDFObjectHandle catalog = pdf.getRoot();
-    QPDFObjectHandle struct_root = catalog.getKey("/StructTreeRoot");
-    if (!struct_root.isDictionary()) {
-      rb_raise(rb_eRuntimeError, "No StructTreeRoot found");
+  run_without_gvl(h, rb_eRuntimeError, [&] {
+    QPDF& pdf = h->qpdf();
+    std::vector<QPDFObjectHandle> const& pages = pdf.getAllPages();
+    if (page_number < 1 || static_cast<size_t>(page_number) > pages.size()) {
+      throw std::runtime_error("page " + std::to_string(page_number) + " out of range (1.." +
+                               std::to_string(pages.size()) + ")");
     }
-    QPDFObjectHandle topKids = struct_root.getKey("/K");
 
-    PDFImageMapper finder(0);
+    QPDFObjectHandle element = h->parent_tree().find(pages[page_number - 1].getObjGen(), mcid);
+    if (element.isNull()) return;
+
+    found = true;
+    QPDFObjectHandle s = element.getKey("/S");
+    tag = s.isName() ? s.getName().substr(1) : "Unknown";
+    og = element.getObjGen();
+  });
+
+  if (!found) return Qnil;
+
+  VALUE result = rb_hash_new();
+  rb_hash_aset(result, ID2SYM(rb_intern("tag")), rb_utf8_str_new(tag.data(), static_cast<long>(tag.size())));
+  rb_hash_aset(result, ID2SYM(rb_intern("obj")), INT2NUM(og.getObj()));
+  rb_hash_aset(result, ID2SYM(rb_intern("gen")), INT2NUM(og.getGen()));
+  return result;
+}
 
-    finder.find(pdf);
+/**
+ * call-seq: lint(threads: 1) -> [{rule:, message:, obj:, gen:, page:, mcid:}, …]
+ *
+ * PAC-style checks on the document: /MarkInfo and /Lang in the catalog,
+ * Figures without /Alt or a layout BBox, and MCIDs the page content and
+ * the structure tree (or its ParentTree) disagree about. `rule` is a
+ * Symbol; `obj`, `gen`, `page` and `mcid` are left out where they don't
+ * apply. An empty Array means no findings.
+ */
+VALUE rb_qpdf_lint(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[1] = {rb_intern("threads")};
+  VALUE values[1] = {Qundef};
 
-    std::unordered_map<int, std::array<double, 4>> mcid2bbox;
-    for (const auto& kv : finder.getImageMap()) {
-      if (kv.second.mcid >= 0) mcid2bbox[kv.second.mcid] = kv.second.bbox;
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 1, values);
+  unsigned threads = threads_option(values[0]);
+
+  DocumentHandle* h = get_handle(self);
+  std::vector<AccessibilityLint::Issue> issues;
+
+  run_without_gvl(h, rb_eRuntimeError, [&] { issues = AccessibilityLint::check(*h, threads); });
+
+  VALUE result = rb_ary_new_capa(static_cast<long>(issues.size()));
+  for (auto const& issue : issues) {
+    VALUE hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(rb_intern("rule")), ID2SYM(rb_intern(issue.rule)));
+    rb_hash_aset(hash, ID2SYM(rb_intern("message")),
+                 rb_utf8_str_new(issue.message.data(), static_cast<long>(issue.message.size())));
+    if (issue.obj > 0) {
+      rb_hash_aset(hash, ID2SYM(rb_intern("obj")), INT2NUM(issue.obj));
+      rb_hash_aset(hash, ID2SYM(rb_intern("gen")), INT2NUM(issue.gen));
     }
+    if (issue.page > 0) rb_hash_aset(hash, ID2SYM(rb_intern("page")), INT2NUM(issue.page));
+    if (issue.mcid >= 0) rb_hash_aset(hash, ID2SYM(rb_intern("mcid")), INT2NUM(issue.mcid));
+    rb_ary_push(result, hash);
+  }
+  return result;
+}
+
+static char const* untagged_kind_name(PDFImageMapper::UntaggedSpan::Kind kind) {
+  switch (kind) {
+    case PDFImageMapper::UntaggedSpan::Path:
+      return "path";
+    case PDFImageMapper::UntaggedSpan::Text:
+      return "text";
+    case PDFImageMapper::UntaggedSpan::Image:
+      return "image";
+    case PDFImageMapper::UntaggedSpan::InlineImage:
+      return "inline_image";
+    case PDFImageMapper::UntaggedSpan::Shading:
+      return "shading";
+    case PDFImageMapper::UntaggedSpan::Form:
+      return "form";
+  }
+  return "unknown";
+}
+
+/**
+ * call-seq: untagged_content(artifact: false, threads: 1, compression_level: 6) -> [{page:, kind:, bbox:, …}, …]
+ *
+ * Everything the pages paint outside of both MCID-carrying marked content
+ * and /Artifact, in content order; `kind` is :path, :text, :image,
+ * :inline_image, :shading or :form. With `artifact: true` the same scan
+ * wraps each of them in /Artifact BMC … EMC and reports it with
+ * `artifact: true`. Forms (which may hold tagged content of their own) and
+ * objects split across two content streams are only reported.
+ */
+VALUE rb_qpdf_untagged_content(int argc, VALUE* argv, VALUE self) {
+  VALUE kwargs;
+  ID keys[3] = {rb_intern("artifact"), rb_intern("threads"), rb_intern("compression_level")};
+  VALUE values[3] = {Qundef, Qundef, Qundef};
+
+  rb_scan_args(argc, argv, ":", &kwargs);
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 3, values);
 
-    PDFStructWalker walker(std::cout, mcid2bbox);  // For now, std::cout, unless you pass another stream
+  bool artifact = values[0] != Qundef && RTEST(values[0]);
+  unsigned threads = threads_option(values[1]);
+  int level = compression_level_option(values[2]);
 
-    if (topKids.isArray()) {
-      for (int i = 0; i < topKids.getArrayNItems(); ++i) {
-        walker.ensureLayoutBBox(topKids.getArrayItem(i));
+  DocumentHandle* h = get_handle(self);
+  std::vector<std::pair<int, PDFImageMapper::UntaggedSpan>> spans;  // (1-based page, span)
+
+  run_without_gvl(h, rb_eRuntimeError, [&] {
+    QPDF& pdf = h->qpdf();
+    std::vector<QPDFObjectHandle> const& pages = pdf.getAllPages();
+
+    if (artifact) {
+      PDFArtifactMarker marker(threads, level);
+      PDFImageMapper mapper(0, threads);
+      mapper.findAndMarkUntagged(pdf, marker);
+      h->content_changed();
+
+      auto const& tagging = mapper.getPageTagging();
+      for (size_t i = 0; i < pages.size(); ++i) {
+        auto it = tagging.find(pages[i].getObjGen());
+        if (it == tagging.end()) continue;
+        for (auto const& span : it->second.untagged) spans.emplace_back(static_cast<int>(i) + 1, span);
       }
-    } else {
-      walker.ensureLayoutBBox(topKids);
+      return;
     }
-  } catch (const std::exception& e) {
-    rb_raise(rb_eRuntimeError, "Error: %s", e.what());
+
+    std::set<QPDFObjGen> all_pages;
+    for (auto const& page : pages) all_pages.insert(page.getObjGen());
+    McidIndex& index = h->mcid_index();
+    index.indexPages(pdf, all_pages, threads);
+    for (size_t i = 0; i < pages.size(); ++i) {
+      for (auto const& span : index.untagged(pages[i].getObjGen())) spans.emplace_back(static_cast<int>(i) + 1, span);
+    }
+  });
+
+  VALUE sym_page = ID2SYM(rb_intern("page"));
+  VALUE sym_kind = ID2SYM(rb_intern("kind"));
+  VALUE sym_bbox = ID2SYM(rb_intern("bbox"));
+  VALUE sym_artifact = ID2SYM(rb_intern("artifact"));
+  VALUE result = rb_ary_new_capa(static_cast<long>(spans.size()));
+  for (auto const& [page, span] : spans) {
+    VALUE bbox = rb_ary_new_capa(4);
+    for (double v : span.bbox) rb_ary_push(bbox, DBL2NUM(v));
+
+    VALUE element = rb_hash_new();
+    rb_hash_aset(element, sym_page, INT2NUM(page));
+    rb_hash_aset(element, sym_kind, ID2SYM(rb_intern(untagged_kind_name(span.kind))));
+    rb_hash_aset(element, sym_bbox, bbox);
+    rb_hash_aset(element, sym_artifact, artifact && span.wrappable() ? Qtrue : Qfalse);
+    rb_ary_push(result, element);
   }
-  return Qnil;
+  return result;
 }
 
-static void doc_free(void* ptr) { qpdf_ruby::qpdf_ruby_close(static_cast<qpdf_ruby::DocumentHandle*>(ptr)); }
+// rb_gc_mark (not the movable variant) pins `source`, so compaction can't move bytes QPDF points into.
+static void doc_mark(void* ptr) { rb_gc_mark(static_cast<RubyDocument*>(ptr)->source); }
 
-static VALUE doc_alloc(VALUE klass) { return Data_Wrap_Struct(klass, /* mark */ 0, doc_free, nullptr); }
+static void doc_free(void* ptr) {
+  auto* doc = static_cast<RubyDocument*>(ptr);
+  qpdf_ruby::qpdf_ruby_close(doc->handle);
+  delete doc;
+}
+
+static VALUE doc_alloc(VALUE klass) { return Data_Wrap_Struct(klass, doc_mark, doc_free, new RubyDocument()); }
 
 static VALUE doc_initialize(int argc, VALUE* argv, VALUE self) {
   VALUE filename, password;
@@ -155,64 +734,97 @@ static VALUE doc_initialize(int argc, VALUE* argv, VALUE self) {
 
   Check_Type(filename, T_STRING);
 
-  const char* pw = "";
+  std::string pw;
   if (!NIL_P(password)) {
     Check_Type(password, T_STRING);
     pw = StringValueCStr(password);
   }
+  std::string path = StringValueCStr(filename);
 
-  try {
-    DocumentHandle* h = qpdf_ruby::qpdf_ruby_open(StringValueCStr(filename), pw);
-    if (!h) rb_sys_fail("qpdf_ruby_open");
-    DATA_PTR(self) = h;
-  } catch (const std::exception& e) {
-    rb_raise(rb_eQpdfRubyError, "%s", e.what());
-  }
+  DocumentHandle* h = nullptr;
+  run_without_gvl(nullptr, rb_eQpdfRubyError, [&] { h = qpdf_ruby::qpdf_ruby_open(path.c_str(), pw.c_str()); });
+  if (!h) rb_sys_fail("qpdf_ruby_open");
+  static_cast<RubyDocument*>(DATA_PTR(self))->handle = h;
 
   return self;
 }
 
 static VALUE doc_write(VALUE self, VALUE out_filename) {
   Check_Type(out_filename, T_STRING);
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
-  if (qpdf_ruby::qpdf_ruby_write(h, StringValueCStr(out_filename)) == -1) rb_sys_fail("qpdf_ruby_write");
+  DocumentHandle* h = get_handle(self);
+  std::string path = StringValueCStr(out_filename);
+
+  int rc = 0;
+  run_without_gvl(h, rb_eQpdfRubyError, [&] { rc = qpdf_ruby::qpdf_ruby_write(h, path.c_str()); });
+  if (rc == -1) rb_sys_fail("qpdf_ruby_write");
 
   return Qnil;
 }
 
 VALUE qpdf_ruby_write_memory(DocumentHandle* h) {
   if (!h) rb_sys_fail("Bad handle");
-  std::string bytes;
 
-  try {
-    bytes = h->write_to_memory();
-  } catch (const std::exception& e) {
-    rb_raise(rb_eQpdfRubyError, "%s", e.what());
-  }
-  return rb_str_new(bytes.data(), bytes.size());
+  // QPDFWriter fills the Ruby String directly – no intermediate Buffer/std::string copies.
+  qpdf_ruby::RubyStringPipeline out;
+  run_without_gvl(h, rb_eQpdfRubyError, [&] { h->write_to(&out); });
+  return out.result();
 }
 
+/**
+ * call-seq: write_to(io, chunk_size: 65536) -> Integer
+ *
+ * Streams the PDF to anything responding to #write (File, socket, Rack body,
+ * multipart uploader, …) in chunks of `chunk_size` bytes. Returns the number
+ * of bytes written.
+ */
+static VALUE doc_write_to(int argc, VALUE* argv, VALUE self) {
+  VALUE io, kwargs;
+  rb_scan_args(argc, argv, "1:", &io, &kwargs);
+
+  ID keys[1] = {rb_intern("chunk_size")};
+  VALUE values[1] = {Qundef};
+  if (!NIL_P(kwargs)) rb_get_kwargs(kwargs, keys, 0, 1, values);
+  size_t chunk_size = values[0] == Qundef ? qpdf_ruby::RubyIOPipeline::DEFAULT_CHUNK_SIZE : NUM2SIZET(values[0]);
+  if (chunk_size == 0) rb_raise(rb_eArgError, "chunk_size must be positive");
+
+  DocumentHandle* h = get_handle(self);
+  qpdf_ruby::RubyIOPipeline out(io, rb_intern("write"), chunk_size);
+  run_without_gvl(h, rb_eQpdfRubyError, [&] { h->write_to(&out); });
+  RB_GC_GUARD(io);
+
+  return SIZET2NUM(out.bytes_written());
+}
+
+/**
+ * Opens a PDF held in a Ruby String without copying it.
+ *
+ * QPDF reads straight from the String's buffer; a frozen (copy-on-write)
+ * view of the argument is pinned by the Document for its whole lifetime.
+ */
 static VALUE doc_from_memory(VALUE klass, VALUE str, VALUE password) {
   Check_Type(str, T_STRING);
   Check_Type(password, T_STRING);
-  DocumentHandle* h;
-  try {
-    h = qpdf_ruby_open_memory("ruby-memory", reinterpret_cast<unsigned char const*>(RSTRING_PTR(str)), RSTRING_LEN(str),
-                              StringValueCStr(password));
-  } catch (const std::exception& e) {
-    rb_raise(rb_eQpdfRubyError, "%s", e.what());
-  }
+  std::string pw = StringValueCStr(password);
+
+  VALUE obj = doc_alloc(klass);
+  auto* doc = static_cast<RubyDocument*>(DATA_PTR(obj));
+  doc->source = rb_str_new_frozen(str);
+
+  char const* buf = RSTRING_PTR(doc->source);
+  size_t len = RSTRING_LEN(doc->source);
+
+  DocumentHandle* h = nullptr;
+  run_without_gvl(nullptr, rb_eQpdfRubyError,
+                  [&] { h = qpdf_ruby_open_memory_borrowed("ruby-memory", buf, len, pw.c_str()); });
 
   if (!h) rb_sys_fail("qpdf_ruby_open_memory");
+  doc->handle = h;
 
-  VALUE obj = Data_Wrap_Struct(klass, 0, doc_free, h);
   return obj;
 }
 
 static VALUE doc_to_memory(VALUE self) {
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
+  DocumentHandle* h = get_handle(self);
   return qpdf_ruby_write_memory(h);  // returns a Ruby ::String
 }
 
@@ -252,22 +864,24 @@ VALUE rb_qpdf_doc_set_encryption(int argc, VALUE* argv, VALUE self) {
   // Get values for each keyword, or Qnil if missing
   rb_get_kwargs(kwargs, keys, 0, 12, values);
 
-  DocumentHandle* h;
-  Data_Get_Struct(self, DocumentHandle, h);
-
-  h->set_encryption(StringValueCStr(values[0]),                        // user_pw
-                    StringValueCStr(values[1]),                        // owner_pw
-                    NUM2INT(values[2]),                                // r
-                    static_cast<qpdf_r3_print_e>(NUM2INT(values[3])),  // allow_print
-                    RTEST(values[4]),                                  // allow_modify
-                    RTEST(values[5]),                                  // allow_extract
-                    RTEST(values[6]),                                  // accessibility
-                    RTEST(values[7]),                                  // assemble
-                    RTEST(values[8]),                                  // annotate_and_form
-                    RTEST(values[9]),                                  // form_filling
-                    RTEST(values[10]),                                 // encrypt_metadata
-                    RTEST(values[11])                                  // use_aes
-  );
+  std::string user_pw = StringValueCStr(values[0]);
+  std::string owner_pw = StringValueCStr(values[1]);
+  int r = NUM2INT(values[2]);
+  auto allow_print = static_cast<qpdf_r3_print_e>(NUM2INT(values[3]));
+
+  DocumentHandle* h = get_handle(self);
+  update_handle(h, [&] {
+    h->set_encryption(user_pw, owner_pw, r, allow_print,
+                      RTEST(values[4]),   // allow_modify
+                      RTEST(values[5]),   // allow_extract
+                      RTEST(values[6]),   // accessibility
+                      RTEST(values[7]),   // assemble
+                      RTEST(values[8]),   // annotate_and_form
+                      RTEST(values[9]),   // form_filling
+                      RTEST(values[10]),  // encrypt_metadata
+                      RTEST(values[11])   // use_aes
+    );
+  });
   return Qnil;
 }
 
@@ -283,10 +897,19 @@ RUBY_FUNC_EXPORTED "C" void Init_qpdf_ruby(void) {
 
   rb_define_method(rb_cDocument, "write", RUBY_METHOD_FUNC(doc_write), 1);
   rb_define_method(rb_cDocument, "to_memory", RUBY_METHOD_FUNC(doc_to_memory), 0);
-
-  rb_define_method(rb_cDocument, "mark_paths_as_artifacts", RUBY_METHOD_FUNC(rb_qpdf_mark_paths_as_artifacts), 0);
-  rb_define_method(rb_cDocument, "ensure_bbox", RUBY_METHOD_FUNC(rb_qpdf_ensure_bboxs), 0);
-  rb_define_method(rb_cDocument, "show_structure", RUBY_METHOD_FUNC(rb_qpdf_get_structure_string), 0);
+  rb_define_method(rb_cDocument, "write_to", RUBY_METHOD_FUNC(doc_write_to), -1);
+
+  rb_define_method(rb_cDocument, "mark_paths_as_artifacts", RUBY_METHOD_FUNC(rb_qpdf_mark_paths_as_artifacts), -1);
+  rb_define_method(rb_cDocument, "ensure_bbox", RUBY_METHOD_FUNC(rb_qpdf_ensure_bboxs), -1);
+  rb_define_method(rb_cDocument, "elements_at", RUBY_METHOD_FUNC(rb_qpdf_elements_at), -1);
+  rb_define_method(rb_cDocument, "struct_element_for", RUBY_METHOD_FUNC(rb_qpdf_struct_element_for), -1);
+  rb_define_method(rb_cDocument, "lint", RUBY_METHOD_FUNC(rb_qpdf_lint), -1);
+  rb_define_method(rb_cDocument, "untagged_content", RUBY_METHOD_FUNC(rb_qpdf_untagged_content), -1);
+  rb_define_method(rb_cDocument, "accessibility_fixup", RUBY_METHOD_FUNC(rb_qpdf_accessibility_fixup), -1);
+  rb_define_method(rb_cDocument, "show_structure", RUBY_METHOD_FUNC(rb_qpdf_get_structure_string), -1);
+  rb_define_method(rb_cDocument, "structure_tree", RUBY_METHOD_FUNC(rb_qpdf_structure_tree), -1);
+  rb_define_method(rb_cDocument, "each_struct_element", RUBY_METHOD_FUNC(rb_qpdf_each_struct_element), -1);
+  rb_define_method(rb_cDocument, "structure_limits", RUBY_METHOD_FUNC(rb_qpdf_structure_limits), -1);
   rb_define_method(rb_cDocument, "encrypt", RUBY_METHOD_FUNC(rb_qpdf_doc_set_encryption), -1);
 
   rb_define_const(rb_mQpdfRuby, "PRINT_FULL", INT2NUM(qpdf_r3p_full));
@@ -2,10 +2,19 @@
 #define QPDF_RUBY_H 1
 
 #include "ruby.h"
+#include "ruby/encoding.h"
 
-VALUE rb_qpdf_mark_paths_as_artifacts(VALUE self);
-VALUE rb_qpdf_ensure_bboxs(VALUE self);
-VALUE rb_qpdf_get_structure_string(VALUE self);
+VALUE rb_qpdf_mark_paths_as_artifacts(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_ensure_bboxs(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_elements_at(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_struct_element_for(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_lint(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_untagged_content(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_accessibility_fixup(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_get_structure_string(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_structure_tree(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_each_struct_element(int argc, VALUE* argv, VALUE self);
+VALUE rb_qpdf_structure_limits(int argc, VALUE* argv, VALUE self);
 VALUE rb_qpdf_doc_set_encryption(int argc, VALUE* argv, VALUE self);
 
 #endif /* QPDF_RUBY_H */
@@ -0,0 +1,64 @@
+#include "ruby_pipeline.hpp"
+#include "without_gvl.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace qpdf_ruby {
+
+RubyIOPipeline::RubyIOPipeline(VALUE target, ID method, size_t chunk_size)
+    : Pipeline("ruby io", nullptr),
+      m_target(target),
+      m_method(method),
+      m_chunk_size(std::max<size_t>(chunk_size, 1)),
+      m_chunk(rb_str_buf_new(m_chunk_size)) {}
+
+void RubyIOPipeline::write(unsigned char const* data, size_t len) {
+  while (len > 0) {
+    size_t n = std::min(len, m_chunk_size - m_fill);
+    memcpy(RSTRING_PTR(m_chunk) + m_fill, data, n);
+    m_fill += n;
+    data += n;
+    len -= n;
+    if (m_fill == m_chunk_size) flush();
+  }
+}
+
+void RubyIOPipeline::finish() {
+  if (m_fill > 0) flush();
+}
+
+void RubyIOPipeline::flush() {
+  check_interrupts();
+  // The receiver may keep the String it is given, so every chunk is a fresh one.
+  call_with_gvl([this] { rb_funcall(m_target, m_method, 1, rb_str_new(RSTRING_PTR(m_chunk), m_fill)); });
+  m_written += m_fill;
+  m_fill = 0;
+}
+
+RubyStringPipeline::RubyStringPipeline(size_t initial_capacity)
+    : Pipeline("ruby string", nullptr), m_str(rb_str_buf_new(initial_capacity)), m_capacity(rb_str_capacity(m_str)) {}
+
+void RubyStringPipeline::write(unsigned char const* data, size_t len) {
+  if (m_len + len > m_capacity) reserve(m_len + len);
+  // Nobody else can see the String yet, so filling it without the GVL is safe.
+  memcpy(RSTRING_PTR(m_str) + m_len, data, len);
+  m_len += len;
+}
+
+void RubyStringPipeline::reserve(size_t needed) {
+  check_interrupts();
+  size_t target = std::max(needed, m_capacity * 2);
+  call_with_gvl([&] {
+    rb_str_set_len(m_str, m_len);
+    rb_str_modify_expand(m_str, target - m_len);
+    m_capacity = rb_str_capacity(m_str);
+  });
+}
+
+VALUE RubyStringPipeline::result() {
+  rb_str_set_len(m_str, m_len);
+  return m_str;
+}
+
+}  // namespace qpdf_ruby
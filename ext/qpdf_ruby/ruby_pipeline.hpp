@@ -0,0 +1,64 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include "ruby.h"
+
+#include <qpdf/Pipeline.hh>
+
+namespace qpdf_ruby {
+
+/**
+ * Pipeline that hands its output to Ruby in chunks of `chunk_size` bytes by
+ * calling `target.method(chunk)` – e.g. `io.write(chunk)` or `block.call(chunk)`.
+ *
+ * Meant to be driven from inside call_without_gvl(): the GVL is only taken
+ * to deliver a full chunk, so memory use is bounded by the chunk size.
+ */
+class RubyIOPipeline : public Pipeline {
+ public:
+  static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  RubyIOPipeline(VALUE target, ID method, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+  void write(unsigned char const* data, size_t len) override;
+  void finish() override;
+
+  /** Total number of bytes handed to Ruby so far. */
+  size_t bytes_written() const { return m_written; }
+
+ private:
+  void flush();
+
+  VALUE m_target;
+  ID m_method;
+  size_t m_chunk_size;
+  VALUE m_chunk;  // GC owned, so nothing leaks when a Ruby exception unwinds the writer
+  size_t m_fill = 0;
+  size_t m_written = 0;
+};
+
+/**
+ * Pipeline that writes straight into the buffer of a Ruby String, growing it
+ * (with the GVL) when full. The String is created by the constructor, so the
+ * pipeline must be constructed while holding the GVL and kept on the stack of
+ * the Ruby thread. Call result() with the GVL to fix up its length.
+ */
+class RubyStringPipeline : public Pipeline {
+ public:
+  explicit RubyStringPipeline(size_t initial_capacity = 1024 * 1024);
+
+  void write(unsigned char const* data, size_t len) override;
+  void finish() override {}
+
+  VALUE result();
+
+ private:
+  void reserve(size_t needed);
+
+  VALUE m_str;
+  size_t m_len = 0;
+  size_t m_capacity;
+};
+
+}  // namespace qpdf_ruby
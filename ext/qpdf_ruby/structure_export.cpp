@@ -0,0 +1,304 @@
+#include "structure_export.hpp"
+#include "without_gvl.hpp"
+
+#include "ruby/encoding.h"
+
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+using Kind = StructureModel::Kind;
+using Node = StructureModel::Node;
+
+namespace {
+
+// A scalar entry of a node's Hash; attributes and kids are added by each format
+struct Field {
+  enum Type { Symbol, Int };
+
+  char const* key;
+  Type type;
+  std::string_view text;  // Symbol
+  long long number;       // Int
+};
+
+constexpr size_t MAX_FIELDS = 5;  // type, tag or mcid, obj, gen, page
+
+char const* type_name(Kind kind) {
+  switch (kind) {
+    case Kind::Element:
+      return "element";
+    case Kind::Mcid:
+      return "mcid";
+    case Kind::Mcr:
+      return "mcr";
+    case Kind::Objr:
+      return "objr";
+    case Kind::Stream:
+      return "stream";
+    case Kind::Repeated:
+      return "repeated";
+    case Kind::Unknown:
+      break;
+  }
+  return "unknown";
+}
+
+// Fills `fields` in output order and returns how many there are
+size_t scalar_fields(StructureModel const& model, Node const& node, Field (&fields)[MAX_FIELDS]) {
+  size_t n = 0;
+  fields[n++] = {"type", Field::Symbol, type_name(node.kind), 0};
+  if (node.kind == Kind::Element) fields[n++] = {"tag", Field::Symbol, model.text(node.name), 0};
+  if (node.kind == Kind::Unknown) fields[n++] = {"name", Field::Symbol, model.text(node.name), 0};
+  if (node.kind == Kind::Mcid || node.kind == Kind::Mcr) fields[n++] = {"mcid", Field::Int, {}, node.mcid};
+  if (node.kind == Kind::Stream) fields[n++] = {"length", Field::Int, {}, static_cast<long long>(node.length)};
+  if (node.obj) {
+    fields[n++] = {"obj", Field::Int, {}, node.obj};
+    fields[n++] = {"gen", Field::Int, {}, node.gen};
+  }
+  if (node.page > 0) fields[n++] = {"page", Field::Int, {}, node.page};
+  return n;
+}
+
+// ---- JSON -----------------------------------------------------------------
+
+void json_string(std::string& out, std::string_view text) {
+  out += '"';
+  for (char ch : text) {
+    unsigned char c = static_cast<unsigned char>(ch);
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04x", c);
+          out += escape;
+        } else {
+          out += ch;
+        }
+    }
+  }
+  out += '"';
+}
+
+// ---- MessagePack ----------------------------------------------------------
+
+void pack_be(std::string& out, uint64_t value, int bytes) {
+  for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xff);
+}
+
+void pack_header(std::string& out, size_t size, uint8_t fix, size_t fix_max, uint8_t marker16) {
+  if (size <= fix_max) {
+    out += static_cast<char>(fix | size);
+  } else if (size <= 0xffff) {
+    out += static_cast<char>(marker16);
+    pack_be(out, size, 2);
+  } else {
+    out += static_cast<char>(marker16 + 1);
+    pack_be(out, size, 4);
+  }
+}
+
+void pack_map(std::string& out, size_t size) { pack_header(out, size, 0x80, 15, 0xde); }
+void pack_array(std::string& out, size_t size) { pack_header(out, size, 0x90, 15, 0xdc); }
+
+void pack_string(std::string& out, std::string_view text) {
+  if (text.size() <= 31) {
+    out += static_cast<char>(0xa0 | text.size());
+  } else if (text.size() <= 0xff) {
+    out += static_cast<char>(0xd9);
+    pack_be(out, text.size(), 1);
+  } else {
+    pack_header(out, text.size(), 0, 0, 0xda);
+  }
+  out.append(text);
+}
+
+void pack_int(std::string& out, long long value) {
+  if (value >= 0 && value <= 0x7f) {
+    out += static_cast<char>(value);
+  } else if (value >= -32 && value < 0) {
+    out += static_cast<char>(0xe0 | (value + 32));
+  } else if (value >= INT32_MIN && value <= INT32_MAX) {
+    out += static_cast<char>(0xd2);
+    pack_be(out, static_cast<uint32_t>(value), 4);
+  } else {
+    out += static_cast<char>(0xd3);
+    pack_be(out, static_cast<uint64_t>(value), 8);
+  }
+}
+
+}  // namespace
+
+VALUE StructureRubyBuilder::tree() {
+  VALUE roots = rb_ary_new_capa(model.rootCount());
+  // (node, Array to append it to); every Array is already reachable from `roots`
+  std::vector<std::pair<uint32_t, VALUE>> stack;
+  for (uint32_t i = model.rootCount(); i-- > 0;) stack.emplace_back(i, roots);
+
+  while (!stack.empty()) {
+    auto [index, parent] = stack.back();
+    stack.pop_back();
+    Node const& node = model.node(index);
+
+    VALUE hash = this->node(index);
+    rb_ary_push(parent, hash);
+
+    if (node.kind == Kind::Element) {
+      VALUE kids = rb_ary_new_capa(node.child_count);
+      rb_hash_aset(hash, symbol("kids"), kids);
+      for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) stack.emplace_back(i, kids);
+    }
+  }
+  return roots;
+}
+
+VALUE StructureRubyBuilder::node(uint32_t index) {
+  Node const& node = model.node(index);
+  VALUE hash = rb_hash_new();
+
+  Field fields[MAX_FIELDS];
+  size_t count = scalar_fields(model, node, fields);
+  for (size_t i = 0; i < count; ++i) {
+    Field const& f = fields[i];
+    rb_hash_aset(hash, symbol(f.key), f.type == Field::Symbol ? symbol(f.text) : LL2NUM(f.number));
+  }
+
+  if (node.attribute_count > 0) {
+    VALUE attributes = rb_hash_new();
+    for (uint32_t i = node.first_attribute; i < node.first_attribute + node.attribute_count; ++i) {
+      auto const& attribute = model.attribute(i);
+      std::string_view value = model.text(attribute.value);
+      rb_hash_aset(attributes, symbol(model.text(attribute.name)),
+                   rb_utf8_str_new(value.data(), static_cast<long>(value.size())));
+    }
+    rb_hash_aset(hash, symbol("attributes"), attributes);
+  }
+  return hash;
+}
+
+VALUE StructureRubyBuilder::symbol(std::string_view text) {
+  auto [it, inserted] = symbols.try_emplace(text, Qnil);
+  if (inserted) {
+    // Model text is valid UTF-8; rb_str_intern makes a dynamic Symbol, not an immortal one
+    it->second = rb_str_intern(rb_utf8_str_new(text.data(), static_cast<long>(text.size())));
+    rb_ary_push(pinned, it->second);
+  }
+  return it->second;
+}
+
+void structure_to_json(StructureModel const& model, std::string& out) {
+  struct Frame {
+    uint32_t index;
+    bool comma;    // a sibling precedes this node
+    bool closing;  // the Element's kids are done, only `]}` is left
+  };
+  std::vector<Frame> stack;
+  for (uint32_t i = model.rootCount(); i-- > 0;) stack.push_back({i, i > 0, false});
+
+  out += '[';
+  while (!stack.empty()) {
+    Frame frame = stack.back();
+    stack.pop_back();
+    if (frame.closing) {
+      out += "]}";
+      continue;
+    }
+
+    qpdf_ruby::check_interrupts();
+    Node const& node = model.node(frame.index);
+    if (frame.comma) out += ',';
+
+    Field fields[MAX_FIELDS];
+    size_t count = scalar_fields(model, node, fields);
+    out += '{';
+    for (size_t i = 0; i < count; ++i) {
+      if (i > 0) out += ',';
+      json_string(out, fields[i].key);
+      out += ':';
+      if (fields[i].type == Field::Symbol) {
+        json_string(out, fields[i].text);
+      } else {
+        out += std::to_string(fields[i].number);
+      }
+    }
+
+    if (node.attribute_count > 0) {
+      out += ",\"attributes\":{";
+      for (uint32_t i = node.first_attribute; i < node.first_attribute + node.attribute_count; ++i) {
+        if (i > node.first_attribute) out += ',';
+        json_string(out, model.text(model.attribute(i).name));
+        out += ':';
+        json_string(out, model.text(model.attribute(i).value));
+      }
+      out += '}';
+    }
+
+    if (node.kind != Kind::Element) {
+      out += '}';
+      continue;
+    }
+    out += ",\"kids\":[";
+    stack.push_back({frame.index, false, true});
+    for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) {
+      stack.push_back({i, i > node.first_child, false});
+    }
+  }
+  out += ']';
+}
+
+void structure_to_msgpack(StructureModel const& model, std::string& out) {
+  // MessagePack prefixes every container with its size, so nothing needs closing
+  std::vector<uint32_t> stack;
+  for (uint32_t i = model.rootCount(); i-- > 0;) stack.push_back(i);
+
+  pack_array(out, model.rootCount());
+  while (!stack.empty()) {
+    qpdf_ruby::check_interrupts();
+    Node const& node = model.node(stack.back());
+    stack.pop_back();
+
+    Field fields[MAX_FIELDS];
+    size_t count = scalar_fields(model, node, fields);
+    bool element = node.kind == Kind::Element;
+    pack_map(out, count + (node.attribute_count > 0) + element);
+
+    for (size_t i = 0; i < count; ++i) {
+      pack_string(out, fields[i].key);
+      if (fields[i].type == Field::Symbol) {
+        pack_string(out, fields[i].text);
+      } else {
+        pack_int(out, fields[i].number);
+      }
+    }
+
+    if (node.attribute_count > 0) {
+      pack_string(out, "attributes");
+      pack_map(out, node.attribute_count);
+      for (uint32_t i = node.first_attribute; i < node.first_attribute + node.attribute_count; ++i) {
+        pack_string(out, model.text(model.attribute(i).name));
+        pack_string(out, model.text(model.attribute(i).value));
+      }
+    }
+
+    if (element) {
+      pack_string(out, "kids");
+      pack_array(out, node.child_count);
+      for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) stack.push_back(i);
+    }
+  }
+}
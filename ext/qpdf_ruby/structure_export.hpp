@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ruby.h"
+
+#include "structure_model.hpp"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * Turns StructureModel nodes into Ruby Hashes:
+ * `{type: :element, tag: :Figure, obj:, gen:, page:, attributes: {Alt: …}, kids: […]}`
+ * for elements, `{type: :mcid, mcid: 3}` and alike for the leaves. Tags
+ * and keys are Symbols, each created once per builder; those made from
+ * PDF names can be garbage collected again. Creates Ruby objects, so it
+ * needs the GVL, and it may raise: build under rb_protect, with the
+ * builder on the stack so GC sees the Symbols it holds.
+ */
+class StructureRubyBuilder {
+ public:
+  explicit StructureRubyBuilder(StructureModel const& model) : model(model), pinned(rb_ary_new()) {}
+
+  /** The whole tree, as an Array of the top-level nodes. */
+  VALUE tree();
+
+  /** One node without its kids. */
+  VALUE node(uint32_t index);
+
+ private:
+  VALUE symbol(std::string_view text);
+
+  StructureModel const& model;
+  std::unordered_map<std::string_view, VALUE> symbols;
+  VALUE pinned;  // the same Symbols, reachable for GC while the builder is in use
+};
+
+/** The same tree as JSON (tags as strings), appended to `out`. Touches no Ruby objects. */
+void structure_to_json(StructureModel const& model, std::string& out);
+
+/** The same tree as MessagePack (tags as strings), appended to `out`. Touches no Ruby objects. */
+void structure_to_msgpack(StructureModel const& model, std::string& out);
@@ -0,0 +1,462 @@
+#include "structure_model.hpp"
+#include "pdf_struct_walker.hpp"
+#include "without_gvl.hpp"
+
+#include <cstdio>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+std::string without_slash(std::string const& name) { return (!name.empty() && name[0] == '/') ? name.substr(1) : name; }
+
+// Length of the well-formed UTF-8 sequence at text[i], or 0 if none starts there
+size_t utf8_sequence(std::string_view text, size_t i) {
+  auto byte = [&](size_t k) { return i + k < text.size() ? static_cast<unsigned char>(text[i + k]) : 0; };
+  unsigned char c = byte(0);
+  if (c < 0x80) return 1;
+
+  size_t length = 0;
+  unsigned char low = 0x80, high = 0xBF;  // range of the second byte
+  if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    if (c == 0xE0) low = 0xA0;   // overlong
+    if (c == 0xED) high = 0x9F;  // surrogates
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    if (c == 0xF0) low = 0x90;   // overlong
+    if (c == 0xF4) high = 0x8F;  // beyond U+10FFFF
+  } else {
+    return 0;
+  }
+  for (size_t k = 1; k < length; ++k) {
+    unsigned char b = byte(k);
+    if (b < (k == 1 ? low : 0x80) || b > (k == 1 ? high : 0xBF)) return 0;
+  }
+  return length;
+}
+
+// Appends `text` as valid UTF-8. PDF names are plain bytes, so a byte that starts no
+// UTF-8 sequence is taken as Latin-1: /Caf#E9 becomes "Café".
+void append_utf8(std::string& out, std::string_view text) {
+  size_t copied = 0;
+  for (size_t i = 0; i < text.size();) {
+    if (size_t length = utf8_sequence(text, i)) {
+      i += length;
+      continue;
+    }
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    out.append(text.substr(copied, i - copied));
+    out += static_cast<char>(0xC0 | (c >> 6));
+    out += static_cast<char>(0x80 | (c & 0x3F));
+    copied = ++i;
+  }
+  out.append(text.substr(copied));
+}
+
+bool is_name(QPDFObjectHandle dict, char const* key, char const* value) {
+  QPDFObjectHandle name = dict.getKey(key);
+  return name.isName() && name.getName() == value;
+}
+
+// True if a BBox is already present *anywhere* in /A
+bool has_layout_bbox(QPDFObjectHandle node) {
+  if (!node.hasKey("/A")) return false;
+
+  QPDFObjectHandle A = node.getKey("/A");
+  auto has_bbox = [](QPDFObjectHandle dict) {
+    return dict.isDictionary() && is_name(dict, "/O", "/Layout") && dict.hasKey("/BBox");
+  };
+
+  if (A.isDictionary()) return has_bbox(A);
+  if (A.isArray()) {
+    for (int i = 0; i < A.getArrayNItems(); ++i) {
+      if (has_bbox(A.getArrayItem(i))) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// "[llx, lly, urx, ury]" of the layout BBox in /A, or "" if there is none
+std::string layout_bbox_text(QPDFObjectHandle node) {
+  QPDFObjectHandle A = node.getKey("/A");
+  QPDFObjectHandle bbox;
+  if (A.isDictionary() && A.hasKey("/BBox")) {
+    bbox = A.getKey("/BBox");
+  } else if (A.isArray()) {
+    for (int i = 0; i < A.getArrayNItems(); ++i) {
+      QPDFObjectHandle attrs = A.getArrayItem(i);
+      if (attrs.isDictionary() && is_name(attrs, "/O", "/Layout") && attrs.hasKey("/BBox")) {
+        bbox = attrs.getKey("/BBox");
+        break;
+      }
+    }
+  }
+  if (!bbox.isArray()) return "";
+
+  std::string text = "[";
+  char digits[32];
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0) text += ", ";
+    snprintf(digits, sizeof(digits), "%g", bbox.getArrayItem(i).getNumericValue());
+    text += digits;
+  }
+  return text + "]";
+}
+
+// "llx lly urx ury" of a /BBox entry on the element itself, or "" if there is none
+std::string element_bbox_text(QPDFObjectHandle node) {
+  QPDFObjectHandle bbox = node.getKey("/BBox");
+  if (!bbox.isArray() || bbox.getArrayNItems() != 4) return "";
+
+  std::string text;
+  char digits[32];
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0) text += " ";
+    if (bbox.getArrayItem(i).isNumber()) {
+      snprintf(digits, sizeof(digits), "%g", bbox.getArrayItem(i).getNumericValue());
+      text += digits;
+    }
+  }
+  return text;
+}
+
+}  // namespace
+
+class StructureModel::Builder {
+ public:
+  Builder(StructureModel& model, PDFStructWalker& walker, Limits const& limits)
+      : model(model), walker(walker), limits(limits) {}
+
+  // Adds the items of `kids` as top-level nodes, then fills in the whole tree below them.
+  void build(QPDFObjectHandle kids) {
+    std::vector<QPDFObjectHandle> roots;
+    flatten(kids, roots);
+    addNodes(roots, 1);
+    model.root_count = static_cast<uint32_t>(roots.size());
+
+    while (!pending.empty()) {
+      Pending next = std::move(pending.back());
+      pending.pop_back();
+      fill(next.index, next.object, next.depth);
+    }
+  }
+
+ private:
+  struct Pending {
+    uint32_t index;
+    QPDFObjectHandle object;
+    size_t depth;
+  };
+
+  // Appends contiguous slots for `items` and queues them so the first one is filled next.
+  uint32_t addNodes(std::vector<QPDFObjectHandle> const& items, size_t depth) {
+    if (depth > limits.max_depth) {
+      throw StructureLimitExceeded("structure tree is nested deeper than " + std::to_string(limits.max_depth) +
+                                   " levels");
+    }
+    if (model.nodes.size() + items.size() > limits.max_nodes) tooManyNodes();
+
+    uint32_t first = static_cast<uint32_t>(model.nodes.size());
+    model.nodes.resize(model.nodes.size() + items.size());
+    for (size_t i = items.size(); i-- > 0;) {
+      pending.push_back({first + static_cast<uint32_t>(i), items[i], depth});
+    }
+    return first;
+  }
+
+  [[noreturn]] void tooManyNodes() const {
+    throw StructureLimitExceeded("structure tree has more than " + std::to_string(limits.max_nodes) + " nodes");
+  }
+
+  // Items of a /K entry, with nested arrays flattened into the enclosing list.
+  void flatten(QPDFObjectHandle kids, std::vector<QPDFObjectHandle>& items) {
+    std::vector<std::pair<QPDFObjectHandle, int>> arrays;  // arrays being expanded, next item of each
+    auto visit = [&](QPDFObjectHandle item) {
+      if (!item.isArray()) {
+        items.push_back(item);
+      } else if (!item.isIndirect() || visited.insert(item.getObjGen()).second) {
+        arrays.emplace_back(item, 0);
+      }
+    };
+
+    visit(kids);
+    while (!arrays.empty()) {
+      auto& [array, next] = arrays.back();
+      if (next == array.getArrayNItems()) {
+        arrays.pop_back();
+        continue;
+      }
+      visit(array.getArrayItem(next++));
+      if (items.size() > limits.max_nodes) tooManyNodes();
+    }
+  }
+
+  void fill(uint32_t index, QPDFObjectHandle object, size_t depth) {
+    qpdf_ruby::check_interrupts();
+
+    Node& node = model.nodes[index];
+    if (object.isIndirect() && !visited.insert(object.getObjGen()).second) {
+      node.kind = Kind::Repeated;
+      node.obj = object.getObjectID();
+      node.gen = object.getGeneration();
+    } else if (object.isInteger()) {
+      node.kind = Kind::Mcid;
+      node.mcid = object.getIntValue();
+    } else if (object.isDictionary()) {
+      if (is_name(object, "/Type", "/MCR") && object.hasKey("/MCID") && object.hasKey("/Pg")) {
+        QPDFObjectHandle pg = object.getKey("/Pg");
+        node.kind = Kind::Mcr;
+        node.mcid = object.getKey("/MCID").getIntValue();
+        node.obj = pg.getObjectID();
+        node.gen = pg.getGeneration();
+        node.page = walker.getPageNumber(pg);
+      } else if (is_name(object, "/Type", "/OBJR")) {
+        // Only the reference is recorded: the annotation or XObject behind /Obj is never loaded
+        QPDFObjectHandle ref = object.getKey("/Obj");
+        node.kind = Kind::Objr;
+        if (ref.isIndirect()) {
+          node.obj = ref.getObjectID();
+          node.gen = ref.getGeneration();
+        }
+        node.page = walker.getPageNumber(object.getKey("/Pg"));
+      } else if (object.hasKey("/S") || is_name(object, "/Type", "/StructElem")) {
+        fillElement(index, object, depth);
+      } else {
+        node.kind = Kind::Unknown;
+        node.name = intern("Dictionary");
+      }
+    } else if (object.isStream()) {
+      // /Length, or else the raw bytes: never run the filters just to report a size
+      QPDFObjectHandle length = object.getDict().getKey("/Length");
+      node.kind = Kind::Stream;
+      node.length = length.isInteger() && length.getIntValue() >= 0 ? static_cast<size_t>(length.getIntValue())
+                                                                    : object.getRawStreamData()->getSize();
+    } else {
+      node.kind = Kind::Unknown;
+      node.name = intern(object.getTypeName());
+    }
+  }
+
+  void fillElement(uint32_t index, QPDFObjectHandle object, size_t depth) {
+    std::string tag = object.getKey("/S").isName() ? without_slash(object.getKey("/S").getName()) : "Unknown";
+
+    {
+      Node& node = model.nodes[index];
+      node.kind = Kind::Element;
+      node.name = intern(tag);
+      if (object.isIndirect()) {
+        node.obj = object.getObjectID();
+        node.gen = object.getGeneration();
+      }
+      node.page = walker.getPageNumber(walker.findInheritedPage(object));
+      node.first_attribute = static_cast<uint32_t>(model.attributes.size());
+    }
+
+    addStringAttribute(object, "/Alt", "Alt");
+    addStringAttribute(object, "/ActualText", "ActualText");
+    addStringAttribute(object, "/T", "Title");
+    addStringAttribute(object, "/Lang", "Lang");
+    addStringAttribute(object, "/ID", "ID");
+    addClassAttribute(object);
+
+    // A layout BBox in /A wins over a /BBox entry on the element
+    std::string bbox = object.hasKey("/A") ? layout_bbox_text(object) : "";
+    if (bbox.empty()) bbox = element_bbox_text(object);
+    if (!bbox.empty()) addAttribute("BBox", bbox);
+
+    if (tag == "Artifact" && object.getKey("/Type").isName()) {
+      addAttribute("ArtifactType", without_slash(object.getKey("/Type").getName()));
+    }
+    QPDFObjectHandle ns = object.getKey("/NS");
+    if (ns.isDictionary() && ns.getKey("/NS").isName()) {
+      addAttribute("NS", without_slash(ns.getKey("/NS").getName()));
+    }
+    addStringAttribute(object, "/Type", "Type");
+
+    model.nodes[index].attribute_count =
+        static_cast<uint32_t>(model.attributes.size()) - model.nodes[index].first_attribute;
+
+    if (tag == "Figure") addFigure(object);
+
+    if (!object.hasKey("/K")) return;
+
+    std::vector<QPDFObjectHandle> kids;
+    flatten(object.getKey("/K"), kids);
+    // addNodes() grows `nodes`, so only touch this node through its index
+    uint32_t first_child = addNodes(kids, depth + 1);
+    model.nodes[index].first_child = first_child;
+    model.nodes[index].child_count = static_cast<uint32_t>(kids.size());
+  }
+
+  void addFigure(QPDFObjectHandle object) {
+    QPDFObjectHandle page = walker.findInheritedPage(object);
+    if (page.isNull() && object.getKey("/K").isArray()) {
+      // Fall back to the first kid that names its page
+      QPDFObjectHandle kids = object.getKey("/K");
+      for (int i = 0; i < kids.getArrayNItems(); ++i) {
+        QPDFObjectHandle kid = kids.getArrayItem(i);
+        if (kid.isDictionary() && kid.hasKey("/Pg")) {
+          page = kid.getKey("/Pg");
+          break;
+        }
+      }
+    }
+
+    model.figure_list.push_back({object, page, own_mcids(object.getKey("/K"), page), has_layout_bbox(object)});
+  }
+
+  // Kids of /K that are MCIDs on `page`; an MCR without /Pg is on the Figure's page
+  static std::vector<int> own_mcids(QPDFObjectHandle k, QPDFObjectHandle const& page) {
+    std::vector<int> mcids;
+    auto add = [&](QPDFObjectHandle kid) {
+      if (kid.isInteger()) {
+        mcids.push_back(kid.getIntValue());
+      } else if (kid.isDictionary() && kid.getKey("/MCID").isInteger()) {
+        QPDFObjectHandle kid_page = kid.getKey("/Pg");
+        if (kid_page.isNull() || (kid_page.isIndirect() && kid_page.getObjGen() == page.getObjGen())) {
+          mcids.push_back(kid.getKey("/MCID").getIntValue());
+        }
+      }
+    };
+    if (k.isArray()) {
+      for (int i = 0; i < k.getArrayNItems(); ++i) add(k.getArrayItem(i));
+    } else {
+      add(k);
+    }
+    return mcids;
+  }
+
+  void addStringAttribute(QPDFObjectHandle object, char const* key, char const* name) {
+    QPDFObjectHandle value = object.getKey(key);
+    if (value.isString()) addAttribute(name, value.getUTF8Value());
+  }
+
+  void addClassAttribute(QPDFObjectHandle object) {
+    if (!object.hasKey("/C")) return;
+
+    std::string classes;
+    QPDFObjectHandle classObj = object.getKey("/C");
+    if (classObj.isName()) {
+      classes = without_slash(classObj.getName());
+    } else if (classObj.isArray()) {
+      for (int i = 0; i < classObj.getArrayNItems(); ++i) {
+        if (i > 0) classes += " ";
+        if (classObj.getArrayItem(i).isName()) classes += without_slash(classObj.getArrayItem(i).getName());
+      }
+    }
+    addAttribute("Class", classes);
+  }
+
+  void addAttribute(std::string_view name, std::string_view value) {
+    model.attributes.push_back({intern(name), append(value)});
+  }
+
+  Text append(std::string_view text) {
+    size_t offset = model.arena.size();
+    append_utf8(model.arena, text);
+    return {static_cast<uint32_t>(offset), static_cast<uint32_t>(model.arena.size() - offset)};
+  }
+
+  // Tags and attribute names repeat all over a tree; each is stored once
+  Text intern(std::string_view text) {
+    auto [it, inserted] = interned.try_emplace(std::string(text));
+    if (inserted) it->second = append(text);
+    return it->second;
+  }
+
+  StructureModel& model;
+  PDFStructWalker& walker;
+  Limits const& limits;
+  std::vector<Pending> pending;                        // nodes with a slot but no content yet
+  std::unordered_set<QPDFObjGen, ObjGenHash> visited;  // indirect kids and /K arrays met so far
+  std::unordered_map<std::string, Text> interned;
+};
+
+StructureModel StructureModel::build(QPDF& pdf, Limits const& limits) {
+  QPDFObjectHandle struct_root = pdf.getRoot().getKey("/StructTreeRoot");
+  if (!struct_root.isDictionary()) {
+    throw std::runtime_error("No StructTreeRoot found");
+  }
+
+  PDFStructWalker walker;
+  walker.buildPageObjectMap(pdf);
+
+  StructureModel model;
+  Builder(model, walker, limits).build(struct_root.getKey("/K"));
+  return model;
+}
+
+void StructureModel::writeXml(XmlWriter& out) const {
+  struct Frame {
+    uint32_t index;
+    int level;
+    bool closing;  // the Element's children are done, only its closing tag is left
+  };
+  std::vector<Frame> stack;
+  for (uint32_t i = root_count; i-- > 0;) stack.push_back({i, 0, false});
+
+  while (!stack.empty()) {
+    Frame frame = stack.back();
+    stack.pop_back();
+    Node const& node = nodes[frame.index];
+
+    if (frame.closing) {
+      out.indent(frame.level);
+      out << "</" << text(node.name) << ">\n";
+      continue;
+    }
+
+    qpdf_ruby::check_interrupts();
+    writeNode(out, node, frame.level);
+    if (node.kind != Kind::Element) continue;
+
+    stack.push_back({frame.index, frame.level, true});
+    for (uint32_t i = node.first_child + node.child_count; i-- > node.first_child;) {
+      stack.push_back({i, frame.level + 1, false});
+    }
+  }
+}
+
+void StructureModel::writeNode(XmlWriter& out, Node const& node, int level) const {
+  out.indent(level);
+
+  switch (node.kind) {
+    case Kind::Element:
+      out << '<' << text(node.name);
+      if (node.obj) out << " obj=\"" << node.obj << ' ' << node.gen << '"';
+      for (uint32_t i = node.first_attribute; i < node.first_attribute + node.attribute_count; ++i) {
+        out.attribute(text(attributes[i].name), text(attributes[i].value));
+      }
+      if (node.page > 0) out << " Page=\"" << node.page << '"';
+      out << ">\n";
+      break;
+    case Kind::Mcid:
+      out << "[MCID: " << node.mcid << "]\n";
+      break;
+    case Kind::Mcr:
+      out << "[MCR: MCID=" << node.mcid << " PageObj=" << node.obj << " Gen=" << node.gen;
+      if (node.page > 0) out << " PageNumber=" << node.page;
+      out << "]\n";
+      break;
+    case Kind::Objr:
+      out << "[OBJR: Obj=" << node.obj << " Gen=" << node.gen;
+      if (node.page > 0) out << " PageNumber=" << node.page;
+      out << "]\n";
+      break;
+    case Kind::Stream:
+      out << "[Stream: length=" << node.length << "]\n";
+      break;
+    case Kind::Repeated:
+      out << "[Repeated: obj=" << node.obj << " " << node.gen << "]\n";
+      break;
+    case Kind::Unknown:
+      out << "[Unhandled type: " << text(node.name) << "]\n";
+      break;
+  }
+}
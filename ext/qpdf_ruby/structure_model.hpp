@@ -0,0 +1,108 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include <qpdf/QPDF.hh>
+#include <qpdf/QPDFObjectHandle.hh>
+
+#include "xml_writer.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Thrown when a structure tree is nested deeper or has more nodes than StructureModel::Limits allow. */
+class StructureLimitExceeded : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * The structure tree, parsed once into flat arrays. The children of every
+ * node are contiguous in `nodes`, attributes are (name, value) pairs in
+ * one array and all text lives in a single arena, so walking the model
+ * touches no QPDF objects and allocates nothing per node. DocumentHandle
+ * keeps one per document until the structure tree is edited.
+ *
+ * Both building and writing use explicit stacks, so a deep tree can't
+ * overflow the C stack. An object reached a second time (a cycle, or an
+ * element shared by two parents) becomes a Repeated leaf instead of
+ * being expanded again.
+ */
+class StructureModel {
+ public:
+  enum class Kind : uint8_t { Element, Mcid, Mcr, Objr, Stream, Repeated, Unknown };
+
+  // Characters [offset, offset + size) of the text arena, always valid UTF-8
+  struct Text {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+  };
+
+  struct Node {
+    Kind kind = Kind::Unknown;
+    Text name;                 // tag of an Element, type name of an Unknown node
+    uint32_t first_child = 0;  // children are nodes [first_child, first_child + child_count)
+    uint32_t child_count = 0;
+    uint32_t first_attribute = 0;  // attributes [first_attribute, first_attribute + attribute_count)
+    uint32_t attribute_count = 0;
+    int obj = 0;  // object id of an Element (0 if direct) or a Repeated object, of the page of an MCR, of the
+                  // object an OBJR refers to
+    int gen = 0;
+    int page = -1;      // 1-based page of an Element, MCR or OBJR, -1 if unknown
+    int mcid = -1;      // Mcid and Mcr nodes
+    size_t length = 0;  // Stream nodes: encoded length, as stored in the file
+  };
+
+  struct Attribute {
+    Text name;
+    Text value;
+  };
+
+  // What ensure_bbox needs to know about a Figure
+  struct Figure {
+    QPDFObjectHandle element;
+    QPDFObjectHandle page;   // null if neither the Figure, an ancestor nor a kid has a /Pg
+    std::vector<int> mcids;  // MCIDs in its own /K on `page`, as integers or marked-content references
+    bool has_layout_bbox;
+  };
+
+  // Budgets that keep a malformed or hostile tree from tying up a worker
+  struct Limits {
+    size_t max_depth = 1000;
+    size_t max_nodes = 5000000;
+  };
+
+  /**
+   * Parses the tree under /StructTreeRoot; throws if the document has none
+   * and StructureLimitExceeded once the tree exceeds `limits`.
+   */
+  static StructureModel build(QPDF& pdf, Limits const& limits);
+
+  /** The top-level nodes are nodes [0, rootCount()). */
+  uint32_t rootCount() const { return root_count; }
+  size_t size() const { return nodes.size(); }
+  Node const& node(uint32_t i) const { return nodes[i]; }
+  Attribute const& attribute(uint32_t i) const { return attributes[i]; }
+  std::string_view text(Text t) const { return std::string_view(arena).substr(t.offset, t.size); }
+
+  /** Every Figure element, in document order. */
+  std::vector<Figure> const& figures() const { return figure_list; }
+
+  /** Writes the whole tree as indented XML. */
+  void writeXml(XmlWriter& out) const;
+
+ private:
+  class Builder;
+
+  // The line of a leaf node, or the opening tag of an Element
+  void writeNode(XmlWriter& out, Node const& node, int level) const;
+
+  std::vector<Node> nodes;
+  std::vector<Attribute> attributes;
+  std::string arena;
+  uint32_t root_count = 0;
+  std::vector<Figure> figure_list;
+};
@@ -0,0 +1,86 @@
+#include "without_gvl.hpp"
+
+#include "ruby.h"
+#include "ruby/thread.h"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+
+namespace {
+
+struct NativeCall {
+  std::function<void()> const* fn;
+  std::atomic<bool> interrupted{false};
+  bool ran = false;
+  std::exception_ptr error;
+};
+
+// Flag of the call_without_gvl() currently running on this thread, if any.
+thread_local std::atomic<bool>* t_interrupt_flag = nullptr;
+
+void* native_call_body(void* data) {
+  auto* call = static_cast<NativeCall*>(data);
+  qpdf_ruby::InterruptScope scope(&call->interrupted);
+  call->ran = true;
+
+  // Nothing may unwind through Ruby's C frames, so every exception is parked here.
+  try {
+    (*call->fn)();
+  } catch (...) {
+    call->error = std::current_exception();
+  }
+
+  return nullptr;
+}
+
+// Unblocking function: called by Ruby (holding the GVL) from another thread.
+void native_call_unblock(void* data) {
+  static_cast<NativeCall*>(data)->interrupted.store(true, std::memory_order_relaxed);
+}
+
+VALUE ruby_callback_body(VALUE data) {
+  (*reinterpret_cast<std::function<void()> const*>(data))();
+  return Qnil;
+}
+
+void* ruby_callback(void* data) {
+  int state = 0;
+  rb_protect(ruby_callback_body, reinterpret_cast<VALUE>(data), &state);
+  return reinterpret_cast<void*>(static_cast<intptr_t>(state));
+}
+
+}  // namespace
+
+namespace qpdf_ruby {
+
+void call_without_gvl(std::function<void()> const& fn) {
+  NativeCall call;
+  call.fn = &fn;
+
+  // The *2 variant neither starts `fn` nor raises when an interrupt is already
+  // pending, so no Ruby exception can jump over our C++ frames here.
+  rb_thread_call_without_gvl2(native_call_body, &call, native_call_unblock, &call);
+
+  if (call.error) std::rethrow_exception(call.error);
+  if (!call.ran) throw Interrupted();
+}
+
+void call_with_gvl(std::function<void()> const& fn) {
+  void* result = rb_thread_call_with_gvl(ruby_callback, const_cast<std::function<void()>*>(&fn));
+  if (int state = static_cast<int>(reinterpret_cast<intptr_t>(result))) throw RubyError(state);
+}
+
+InterruptScope::Flag* InterruptScope::current() { return t_interrupt_flag; }
+
+InterruptScope::InterruptScope(Flag* flag) : previous(t_interrupt_flag) { t_interrupt_flag = flag; }
+
+InterruptScope::~InterruptScope() { t_interrupt_flag = previous; }
+
+void check_interrupts() {
+  if (t_interrupt_flag && t_interrupt_flag->load(std::memory_order_relaxed)) {
+    throw Interrupted();
+  }
+}
+
+}  // namespace qpdf_ruby
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+
+namespace qpdf_ruby {
+
+/**
+ * Thrown from native code once Ruby asked the calling thread to stop
+ * (Thread#raise, Thread#kill, Timeout, signal handlers, …).
+ */
+class Interrupted : public std::runtime_error {
+ public:
+  Interrupted() : std::runtime_error("qpdf_ruby: native call interrupted") {}
+};
+
+/**
+ * A Ruby exception (or break/throw) raised by a call_with_gvl() callback.
+ * It travels through native frames as a C++ exception and is re-raised
+ * via rb_jump_tag() once the native call has unwound.
+ */
+class RubyError : public std::runtime_error {
+ public:
+  explicit RubyError(int state) : std::runtime_error("qpdf_ruby: Ruby callback raised"), m_state(state) {}
+  int state() const { return m_state; }
+
+ private:
+  int m_state;
+};
+
+/**
+ * Runs `fn` with the GVL released so other Ruby threads keep running.
+ *
+ * `fn` must not touch any Ruby object except through call_with_gvl(). Exceptions thrown by `fn` are
+ * re-thrown on the calling thread once the GVL has been re-acquired.
+ * Throws Interrupted if Ruby interrupted the thread before or while
+ * `fn` was running.
+ */
+void call_without_gvl(std::function<void()> const& fn);
+
+/**
+ * Re-acquires the GVL from inside call_without_gvl() to run `fn`, which may
+ * call into Ruby but must not throw C++ exceptions. A Ruby exception raised
+ * by `fn` is rethrown as RubyError. Only valid on the thread that called
+ * call_without_gvl().
+ */
+void call_with_gvl(std::function<void()> const& fn);
+
+/**
+ * Cancellation point for long running native loops: throws Interrupted
+ * when the surrounding call_without_gvl() has been asked to stop.
+ * A no-op when called outside of call_without_gvl().
+ */
+void check_interrupts();
+
+/**
+ * Lets check_interrupts() on a helper thread (see parallel_for) observe the
+ * call_without_gvl() that spawned it. Capture current() on the calling thread,
+ * then construct a scope with it on the helper thread.
+ */
+class InterruptScope {
+ public:
+  using Flag = std::atomic<bool>;
+
+  static Flag* current();
+
+  explicit InterruptScope(Flag* flag);
+  ~InterruptScope();
+  InterruptScope(const InterruptScope&) = delete;
+  InterruptScope& operator=(const InterruptScope&) = delete;
+
+ private:
+  Flag* previous;
+};
+
+}  // namespace qpdf_ruby
@@ -0,0 +1,85 @@
+#include "xml_writer.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+XmlWriter& XmlWriter::write(char const* data, size_t len) {
+  if (fill + len > buffer.size()) {
+    flush();
+    if (len > buffer.size()) {
+      sink.write(reinterpret_cast<unsigned char const*>(data), len);
+      return *this;
+    }
+  }
+  memcpy(buffer.data() + fill, data, len);
+  fill += len;
+  return *this;
+}
+
+XmlWriter& XmlWriter::operator<<(double value) {
+  char digits[32];
+  int len = snprintf(digits, sizeof(digits), "%g", value);
+  return write(digits, static_cast<size_t>(len));
+}
+
+XmlWriter& XmlWriter::escaped(std::string_view value) {
+  size_t plain = 0;  // start of the run of characters that need no escaping
+  for (size_t i = 0; i < value.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(value[i]);
+    std::string_view replacement;
+    switch (c) {
+      case '&':
+        replacement = "&amp;";
+        break;
+      case '<':
+        replacement = "&lt;";
+        break;
+      case '>':
+        replacement = "&gt;";
+        break;
+      case '"':
+        replacement = "&quot;";
+        break;
+      case '\t':
+        replacement = "&#9;";
+        break;
+      case '\n':
+        replacement = "&#10;";
+        break;
+      case '\r':
+        replacement = "&#13;";
+        break;
+      default:
+        if (c >= 0x20) continue;
+        break;  // other control characters are not allowed in XML 1.0
+    }
+    write(value.data() + plain, i - plain);
+    *this << replacement;
+    plain = i + 1;
+  }
+  return write(value.data() + plain, value.size() - plain);
+}
+
+XmlWriter& XmlWriter::attribute(std::string_view name, std::string_view value) {
+  *this << ' ' << name << "=\"";
+  escaped(value);
+  return *this << '"';
+}
+
+XmlWriter& XmlWriter::indent(int level) {
+  for (int i = 0; i < level; ++i) {
+    *this << "  ";
+  }
+  return *this;
+}
+
+void XmlWriter::flush() {
+  if (fill == 0) return;
+  sink.write(reinterpret_cast<unsigned char const*>(buffer.data()), fill);
+  fill = 0;
+}
+
+void XmlWriter::finish() {
+  flush();
+  sink.finish();
+}
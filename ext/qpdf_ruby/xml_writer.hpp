@@ -0,0 +1,56 @@
+#pragma once
+
+#define POINTERHOLDER_TRANSITION 1
+
+#include <qpdf/Pipeline.hh>
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * Buffered text sink for the structure dump. Every node of a tree writes
+ * into the same writer, which hands full buffers on to a Pipeline (a Ruby
+ * String, a Ruby IO, …), so output costs O(size) whatever the tree depth.
+ */
+class XmlWriter {
+ public:
+  explicit XmlWriter(Pipeline& sink) : sink(sink) {}
+  XmlWriter(const XmlWriter&) = delete;
+  XmlWriter& operator=(const XmlWriter&) = delete;
+
+  XmlWriter& operator<<(std::string_view text) { return write(text.data(), text.size()); }
+  XmlWriter& operator<<(char c) { return write(&c, 1); }
+  // Shortest form with 6 significant digits, as std::ostream prints doubles
+  XmlWriter& operator<<(double value);
+
+  template <typename Int,
+            std::enable_if_t<std::is_integral_v<Int> && !std::is_same_v<Int, char> && !std::is_same_v<Int, bool>,
+                             int> = 0>
+  XmlWriter& operator<<(Int value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return write(digits, result.ptr - digits);
+  }
+
+  /** `value` escaped for a double-quoted attribute; control characters XML can't carry are dropped. */
+  XmlWriter& escaped(std::string_view value);
+
+  /** ` name="value"`, with `value` escaped. */
+  XmlWriter& attribute(std::string_view name, std::string_view value);
+
+  XmlWriter& indent(int level);
+
+  /** Hands everything buffered to the sink, then finishes the sink. */
+  void finish();
+
+ private:
+  XmlWriter& write(char const* data, size_t len);
+  void flush();
+
+  Pipeline& sink;
+  std::array<char, 16 * 1024> buffer;
+  size_t fill = 0;
+};
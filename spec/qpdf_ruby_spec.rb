@@ -5,6 +5,43 @@ RSpec.describe QpdfRuby do
     File.expand_path("./fixtures/#{filename}", __dir__)
   end
 
+  # A PDF with `objects` as objects 1, 2, …; object 1 is the catalog
+  def build_pdf(objects)
+    pdf = +"%PDF-1.7\n"
+    offsets = objects.each_with_index.map do |body, index|
+      pdf.bytesize.tap { pdf << "#{index + 1} 0 obj\n#{body}\nendobj\n" }
+    end
+    xref = pdf.bytesize
+    pdf << "xref\n0 #{objects.size + 1}\n0000000000 65535 f \n"
+    offsets.each { |offset| pdf << format("%010d 00000 n \n", offset) }
+    pdf << "trailer\n<< /Size #{objects.size + 1} /Root 1 0 R >>\nstartxref\n#{xref}\n%%EOF\n"
+  end
+
+  def stream_object(data, dictionary = "")
+    "<< /Length #{data.bytesize} #{dictionary}>>\nstream\n#{data}\nendstream"
+  end
+
+  # A PDF with one 200x200 page drawing `content`; `extra` objects are 5 0 R, 6 0 R, …
+  def page_pdf(content, page: "", catalog: "", extra: [])
+    build_pdf([
+      "<< /Type /Catalog /Pages 2 0 R #{catalog}>>",
+      "<< /Type /Pages /Kids [3 0 R] /Count 1 >>",
+      "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] /Contents 4 0 R #{page}>>",
+      stream_object(content),
+      *extra
+    ])
+  end
+
+  # Streams of a written PDF in file order, as [dictionary, decoded data]
+  def streams_of(pdf)
+    pdf = pdf.b
+    pdf.enum_for(:scan, %r{^\d+ 0 obj\s*(<<[^<>]*>>)\s*stream\r?\n}).map do
+      match = Regexp.last_match
+      data = pdf.byteslice(match.end(0), match[1][%r{/Length (\d+)}, 1].to_i)
+      [match[1], match[1].include?("/FlateDecode") ? Zlib::Inflate.inflate(data) : data]
+    end
+  end
+
   let(:tmp_file) { File.expand_path("../tmp/example_accessibility_test.pdf", __dir__) }
   let(:tmp_file_from_memory) { File.expand_path("../tmp/example_accessibility_test_memory.pdf", __dir__) }
   let(:expected_structure) { File.read(fixture_file("expected_structure_after_patch.xml")) }
@@ -53,6 +90,365 @@ RSpec.describe QpdfRuby do
     expect(actual_xml.to_s).to eq(expected_xml.to_s)
   end
 
+  it "marks paths as artifacts on several threads with the same result", :aggregate_failures do
+    serial = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    serial.mark_paths_as_artifacts
+
+    parallel = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    parallel.mark_paths_as_artifacts(threads: 4)
+
+    capped = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    capped.mark_paths_as_artifacts(threads: 10_000)
+
+    expect(parallel.to_memory).to eq(serial.to_memory)
+    expect(capped.to_memory).to eq(serial.to_memory)
+  end
+
+  it "leaves Figures that already have a BBox alone" do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    doc.ensure_bbox
+    first_pass = doc.show_structure
+
+    doc.ensure_bbox
+
+    expect(doc.show_structure).to eq(first_pass)
+  end
+
+  it "shows bounding boxes added after the structure was first read" do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    doc.show_structure
+
+    doc.mark_paths_as_artifacts
+    doc.ensure_bbox
+
+    # the expected object numbers are those after a write; this document was never written
+    without_obj = lambda do |xml|
+      Nokogiri::XML(xml, &:noblanks).tap { |parsed| parsed.xpath("//@obj").each(&:remove) }.to_s
+    end
+
+    expect(without_obj.call(doc.show_structure)).to eq(without_obj.call(expected_structure))
+  end
+
+  it "raises instead of reading a structure tree beyond its limits", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    doc.structure_limits(max_depth: 2)
+    expect { doc.show_structure }.to raise_error(QpdfRuby::Error, /deeper than 2 levels/)
+
+    doc.structure_limits(max_depth: 1000, max_nodes: 10)
+    expect { doc.ensure_bbox }.to raise_error(QpdfRuby::Error, /more than 10 nodes/)
+  end
+
+  it "shows a structure tree that refers back to itself, with object references and streams", :aggregate_failures do
+    packed = Zlib::Deflate.deflate("x" * 1000)
+    objects = [
+      "<< /Type /Catalog /Pages 2 0 R /StructTreeRoot 4 0 R >>",
+      "<< /Type /Pages /Kids [3 0 R] /Count 1 >>",
+      "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 10 10] >>",
+      "<< /Type /StructTreeRoot /K 5 0 R >>",
+      "<< /Type /StructElem /S /Document /P 4 0 R /Pg 3 0 R /K 6 0 R >>",
+      "<< /Type /StructElem /S /P /P 5 0 R /K [5 0 R 0 << /Type /OBJR /Obj 8 0 R /Pg 3 0 R >> 7 0 R] >>",
+      stream_object(packed, "/Filter /FlateDecode "),
+      "<< /Type /Annot /Subtype /Link /Rect [0 0 1 1] >>"
+    ]
+    doc = QpdfRuby::Document.from_memory(build_pdf(objects), "")
+
+    structure = doc.show_structure
+    kids = doc.structure_tree.first[:kids].first[:kids]
+
+    expect(structure).to include("[Repeated: obj=5 0]")
+    expect(structure).to include("[OBJR: Obj=8 Gen=0 PageNumber=1]")
+    # the stream's /Length, i.e. its encoded size; it is never decoded
+    expect(structure).to include("[Stream: length=#{packed.bytesize}]")
+    expect(kids.last(2)).to eq([{ type: :objr, obj: 8, gen: 0, page: 1 }, { type: :stream, length: packed.bytesize }])
+  end
+
+  it "measures a Figure without ParentTree entries from its own marked content only" do
+    content = <<~CONTENT
+      /P << /MCID 0 >> BDC 100 100 50 50 re f EMC
+      /Figure << /MCID 1 >> BDC 10 10 20 20 re f EMC
+    CONTENT
+    pdf = page_pdf(content, catalog: "/StructTreeRoot 5 0 R ", extra: [
+      "<< /Type /StructTreeRoot /K [6 0 R 7 0 R] >>",
+      "<< /Type /StructElem /S /Figure /P 5 0 R /Pg 3 0 R /K [<< /Type /MCR /MCID 1 >>] >>",
+      "<< /Type /StructElem /S /Figure /P 5 0 R /Pg 3 0 R /K 8 0 R >>",
+      "<< /Type /StructElem /S /P /P 7 0 R /Pg 3 0 R /K 0 >>"
+    ])
+
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+    doc.ensure_bbox
+
+    # the second Figure holds no MCID of its own, so it gets the crop box rather than MCID 0's box
+    boxes = doc.each_struct_element(tag: "Figure").map { |figure| figure[:attributes][:BBox] }
+    expect(boxes).to eq(["[10, 10, 30, 30]", "[0, 0, 200, 200]"])
+  end
+
+  it "ensures bounding boxes on several threads with the same result" do
+    serial = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    serial.ensure_bbox
+
+    parallel = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    parallel.ensure_bbox(threads: 4)
+
+    expect(parallel.show_structure).to eq(serial.show_structure)
+  end
+
+  it "marks paths and ensures bounding boxes in one pass", :aggregate_failures do
+    separate = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    separate.mark_paths_as_artifacts
+    separate.ensure_bbox
+
+    combined = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    timings = combined.accessibility_fixup(threads: 2)
+
+    expect(combined.to_memory).to eq(separate.to_memory)
+    expect(timings.keys).to include(:read, :scan, :structure)
+    expect(timings.values).to all(be >= 0)
+  end
+
+  it "finds marked content by page region", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    hits = doc.elements_at(page: 3, rect: [0, 0, 600, 850])
+
+    expect(hits.map { |hit| hit[:mcid] }).to include(3)
+    expect(doc.elements_at(page: 3, rect: [600, 850, 0, 0])).to eq(hits)
+  end
+
+  it "places Form XObjects through /Matrix and the CTM, clipped to their /BBox" do
+    form = "/Type /XObject /Subtype /Form /BBox [0 0 10 10]"
+    # 40 nested forms, deeper than the scanner follows
+    deep = Array.new(40) do |i|
+      i < 39 ? stream_object("/X Do\n", "#{form} /Resources << /XObject << /X #{8 + i} 0 R >> >> ") : stream_object("0 0 1 1 re f\n", form)
+    end
+    content = <<~CONTENT
+      /P << /MCID 0 >> BDC q 2 0 0 2 10 10 cm /Fx Do Q EMC
+      /P << /MCID 1 >> BDC /Fx Do EMC
+      /P << /MCID 2 >> BDC /Fy Do EMC
+      /P << /MCID 3 >> BDC /Deep Do EMC
+    CONTENT
+    pdf = page_pdf(content,
+                   page: "/Resources << /XObject << /Fx 5 0 R /Fy 6 0 R /Deep 7 0 R >> >> ",
+                   extra: [
+                     stream_object("0 0 20 20 re f\n", "#{form} /Matrix [1 0 0 1 5 0] "),
+                     stream_object("0 0 4 4 re f\n/Fy Do\n", "#{form} /Resources << /XObject << /Fy 6 0 R >> >> "),
+                     *deep
+                   ])
+
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+
+    # /Fx is measured once and placed per use; /Fy paints itself, which is not followed
+    expect(doc.elements_at(page: 1, rect: [0, 0, 200, 200])).to eq(
+      [
+        { mcid: 0, bbox: [20, 10, 40, 30] },
+        { mcid: 1, bbox: [5, 0, 15, 10] },
+        { mcid: 2, bbox: [0, 0, 4, 4] }
+      ]
+    )
+  end
+
+  it "measures inline images and shadings" do
+    function = "<< /FunctionType 2 /Domain [0 1] /C0 [0] /C1 [1] /N 1 >>"
+    shading = "/ShadingType 2 /ColorSpace /DeviceGray /Coords [0 0 1 0] /Function #{function}"
+    content = <<~CONTENT
+      /P << /MCID 0 >> BDC q 20 0 0 10 5 5 cm BI /W 1 /H 1 /BPC 8 /CS /G ID x EI Q EMC
+      /P << /MCID 1 >> BDC q 1 0 0 1 100 100 cm /Boxed sh Q EMC
+      /P << /MCID 2 >> BDC q 50 50 20 30 re W n /Open sh Q EMC
+      /P << /MCID 3 >> BDC /Open sh EMC
+    CONTENT
+    resources = "/Shading << /Boxed << #{shading} /BBox [10 20 30 40] >> /Open << #{shading} >> >>"
+    doc = QpdfRuby::Document.from_memory(page_pdf(content, page: "/Resources << #{resources} >> "), "")
+
+    # an inline image fills the unit square of its CTM; a shading its /BBox, else the clip
+    expect(doc.elements_at(page: 1, rect: [0, 0, 200, 200])).to eq(
+      [
+        { mcid: 0, bbox: [5, 5, 25, 15] },
+        { mcid: 1, bbox: [110, 120, 130, 140] },
+        { mcid: 2, bbox: [50, 50, 70, 80] },
+        { mcid: 3, bbox: [0, 0, 200, 200] }
+      ]
+    )
+  end
+
+  it "finds the structure element that owns marked content", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    expect(doc.struct_element_for(page: 3, mcid: 3)).to eq(tag: "Figure", obj: 70, gen: 0)
+    expect(doc.struct_element_for(page: 3, mcid: 999)).to be_nil
+  end
+
+  it "lints the structure tree and page content", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    before = doc.lint
+    doc.ensure_bbox
+    after = doc.lint(threads: 2)
+
+    expect(before).to all(include(:rule, :message))
+    expect(before.map { |issue| issue[:rule] }).to include(:figure_without_bbox)
+    expect(after.map { |issue| issue[:rule] }).not_to include(:figure_without_bbox, :figure_without_alt)
+  end
+
+  it "finds untagged content and marks it as artifacts", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    found = doc.untagged_content
+    fixed = doc.untagged_content(artifact: true, threads: 2)
+
+    expect(found.map { |span| span[:kind] }).to include(:path)
+    expect(fixed.map { |span| span.except(:artifact) }).to eq(found.map { |span| span.except(:artifact) })
+    expect(doc.untagged_content.size).to eq(fixed.count { |span| !span[:artifact] })
+  end
+
+  it "rewrites a shared content stream once and leaves streams without a match as they are", :aggregate_failures do
+    untouched = Zlib::Deflate.deflate("BT ET\n")
+    pdf = build_pdf([
+      "<< /Type /Catalog /Pages 2 0 R >>",
+      "<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 2 >>",
+      "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] /Contents [5 0 R 6 0 R] >>",
+      "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] /Contents [5 0 R 6 0 R] >>",
+      stream_object("0 0 1 1 re f\n"),
+      stream_object(untouched, "/Filter /FlateDecode ")
+    ])
+    object_count = ->(written) { written.b.scan(/^\d+ 0 obj/).size }
+
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+    unmarked = doc.to_memory
+    doc.mark_paths_as_artifacts
+    marked = doc.to_memory
+
+    expect(object_count.call(marked)).to eq(object_count.call(unmarked))
+    expect(streams_of(marked).map(&:last)).to contain_exactly("/Artifact BMC\n0 0 1 1 re f\nEMC\n", "BT ET\n")
+    expect(marked.b).to include(untouched.b)
+  end
+
+  it "marks a rectangle as an artifact only when it is a path of its own" do
+    doc = QpdfRuby::Document.from_memory(page_pdf("0 0 1 1 re 2 2 3 3 re f\n4 4 1 1 re f\n"), "")
+
+    doc.mark_paths_as_artifacts
+
+    expect(streams_of(doc.to_memory).map(&:last)).to eq(["0 0 1 1 re 2 2 3 3 re f\n/Artifact BMC\n4 4 1 1 re f\nEMC\n"])
+  end
+
+  it "rejects compression levels outside of zlib's range" do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    expect { doc.mark_paths_as_artifacts(compression_level: 10) }.to raise_error(ArgumentError)
+  end
+
+  it "compresses rewritten streams at any level to the same content", :aggregate_failures do
+    content = Array.new(200) { |i| "#{i} #{i} 5 5 re f\n" }.join
+    written = [0, 1, 9].to_h do |level|
+      doc = QpdfRuby::Document.from_memory(page_pdf(content), "")
+      doc.mark_paths_as_artifacts(compression_level: level)
+      [level, streams_of(doc.to_memory)]
+    end
+
+    # level 0 installs the stream unfiltered, and QPDFWriter Flate compresses it on write
+    expect(written.values.flatten(1).map(&:first)).to all(include("/FlateDecode"))
+    expect(written.values.map { |streams| streams.map(&:last) }.uniq.size).to eq(1)
+    expect(written[9].first.last.scan("/Artifact BMC").size).to eq(200)
+  end
+
+  it "streams a PDF to an IO in fixed-size chunks", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    doc.mark_paths_as_artifacts
+    doc.ensure_bbox
+
+    chunks = []
+    io = Object.new
+    io.define_singleton_method(:write) { |chunk| chunks << chunk }
+
+    bytes = doc.write_to(io, chunk_size: 4096)
+
+    expect(chunks[0...-1].map(&:bytesize)).to all(eq(4096))
+    expect(chunks.join).to eq(doc.to_memory)
+    expect(bytes).to eq(chunks.sum(&:bytesize))
+  end
+
+  it "streams the structure XML to an IO or a block", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+    xml = doc.show_structure
+
+    io = StringIO.new
+    bytes = doc.show_structure(io, chunk_size: 1024)
+
+    chunks = []
+    doc.show_structure(chunk_size: 1024) { |chunk| chunks << chunk }
+
+    expect(io.string.b).to eq(xml.b)
+    expect(bytes).to eq(xml.bytesize)
+    expect(chunks[0...-1].map(&:bytesize)).to all(eq(1024))
+    expect(chunks.join).to eq(xml.b)
+  end
+
+  it "exports the structure tree as Ruby objects, JSON and MessagePack", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    tree = doc.structure_tree
+    json = doc.structure_tree(format: :json)
+    msgpack = doc.structure_tree(format: :msgpack)
+
+    expect(tree.first).to include(type: :element, tag: :Document, obj: 43, gen: 0, attributes: { Lang: "en" })
+    expect(JSON.parse(json)).to eq(JSON.parse(JSON.generate(tree)))
+    expect(msgpack.getbyte(0) & 0xf0).to eq(0x90)
+  end
+
+  it "exports tags that are not UTF-8 as Latin-1", :aggregate_failures do
+    pdf = page_pdf("", catalog: "/StructTreeRoot 5 0 R ", extra: [
+      "<< /Type /StructTreeRoot /K 6 0 R >>",
+      "<< /Type /StructElem /S /Caf#E9 /P 5 0 R /Pg 3 0 R >>"
+    ])
+    doc = QpdfRuby::Document.from_memory(pdf, "")
+
+    expect(doc.structure_tree.first[:tag]).to eq(:Café)
+    expect(JSON.parse(doc.structure_tree(format: :json)).first["tag"]).to eq("Café")
+  end
+
+  it "enumerates structure elements by tag and page", :aggregate_failures do
+    doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
+
+    figures = doc.each_struct_element(tag: "Figure").map { |element| element[:obj] }
+    on_page3 = doc.each_struct_element(tag: :Figure, page: 3).first
+
+    expect(figures).to eq([73, 70])
+    expect(on_page3).to include(type: :element, tag: :Figure, obj: 70, page: 3)
+    expect(on_page3).not_to have_key(:kids)
+  end
+
+  it "keeps an in-memory document intact when the caller's string changes" do
+    in_buf = File.binread(fixture_file("example_accessibility.pdf"))
+
+    doc = QpdfRuby::Document.from_memory(in_buf, "")
+    in_buf.replace("not a pdf")
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+
+    actual_xml = Nokogiri::XML(doc.show_structure, &:noblanks)
+    expected_xml = Nokogiri::XML(File.read(fixture_file("expected_structure_after_patch.xml")), &:noblanks)
+
+    expect(actual_xml.xpath("//*").map(&:name)).to eq(expected_xml.xpath("//*").map(&:name))
+  end
+
+  it "patches several documents concurrently" do
+    in_buf = File.binread(fixture_file("example_accessibility.pdf"))
+
+    structures = Array.new(4) do
+      Thread.new do
+        doc = QpdfRuby::Document.from_memory(in_buf, "")
+        doc.mark_paths_as_artifacts
+        doc.ensure_bbox
+        QpdfRuby::Document.from_memory(doc.to_memory, "").show_structure
+      end
+    end.map(&:value)
+
+    expected_xml = Nokogiri::XML(expected_structure, &:noblanks)
+
+    structures.each do |actual_structure|
+      expect(Nokogiri::XML(actual_structure, &:noblanks).to_s).to eq(expected_xml.to_s)
+    end
+  end
+
   it "sets a password on a PDF" do
     doc = QpdfRuby::Document.new(fixture_file("example_accessibility.pdf"))
 
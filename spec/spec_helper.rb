@@ -2,6 +2,9 @@
 
 require "qpdf_ruby"
 require "nokogiri"
+require "json"
+require "stringio"
+require "zlib"
 
 RSpec.configure do |config|
   # Enable flags like --only-failures and --next-failure